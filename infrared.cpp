@@ -1,16 +1,32 @@
 #include <M5Unified.h>
+#include "driver/mcpwm.h"
+#include "soc/gpio_periph.h"
+#include "soc/io_mux_reg.h"
+
+// 1: transmit through the UART (the peripheral times every bit, loop() never blocks)
+// 0: bit-bang with ledcWrite + delayMicroseconds
+#define IR_TX_UART 1
 
 // GPIO pin for IR LED — change if needed
 const int IR_LED_PIN = 26;
 const int IR_RX_PIN = 36;
+// Unused pad carrying UART TXD back into the MCPWM fault input; leave unconnected
+const int IR_TX_LOOP_PIN = 5;
+
+// Line rate for both directions, up to the demodulator's limit
+const int irBaud = 2400;
 
 // PWM config
 const int pwmChannel = 0;
-const int pwmFreq = 38000;  // 38 kHz
 const int pwmResolution = 8;  // 8-bit
 
+// Carrier channels (button B)
+#define CARRIER_CHANNELS 6
+const uint32_t CARRIER_HZ[CARRIER_CHANNELS] = { 30000, 33000, 36000, 38000, 40000, 56000 };
+int carrierChannel = 3;  // 38 kHz
+
 
-// Use Serial2 for IR input (ESP32 has multiple UARTs)
+// Use Serial2 for IR input (ESP32 has multiple UARTs); in UART TX mode it transmits too
 HardwareSerial IRSerial(2);
 
 /*
@@ -39,7 +55,7 @@ bool isSelfEcho(uint8_t received) {
 */
 
 void sendBit(int bit) {
-    // Transmit "0" = 38kHz ON for ~417 μs _______________________________
+    // Transmit "0" = carrier ON for ~417 μs _______________________________
     ledcWrite(pwmChannel, bit?0:128);  // 50% duty
     delayMicroseconds(417);
 }
@@ -54,20 +70,75 @@ void sendByte(uint8_t byte) {
     sendBit(1); // to get the attention of the receiver for the next byte
 }
 
+// The carrier comes from MCPWM0A on the IR LED pin. UART TXD is high
+// when idle and for 1 bits; routed back through the GPIO matrix into fault
+// input F0 it forces the carrier low, cycle by cycle, for as long as it is
+// high. So the LED only flashes the carrier during 0 bits, and start/data/
+// stop bit timing is all done by the UART.
+void setupUartCarrier() {
+    mcpwm_gpio_init(MCPWM_UNIT_0, MCPWM0A, IR_LED_PIN);
+    mcpwm_config_t pwm_cfg = {};
+    pwm_cfg.frequency = CARRIER_HZ[carrierChannel];
+    pwm_cfg.cmpr_a = 50.0;  // 50% duty
+    pwm_cfg.cmpr_b = 0;
+    pwm_cfg.duty_mode = MCPWM_DUTY_MODE_0;
+    pwm_cfg.counter_mode = MCPWM_UP_COUNTER;
+    mcpwm_init(MCPWM_UNIT_0, MCPWM_TIMER_0, &pwm_cfg);
+
+    mcpwm_gpio_init(MCPWM_UNIT_0, MCPWM_FAULT_0, IR_TX_LOOP_PIN);
+    mcpwm_fault_init(MCPWM_UNIT_0, MCPWM_HIGH_LEVEL_TGR, MCPWM_SELECT_F0);
+    mcpwm_fault_set_cyc_mode(MCPWM_UNIT_0, MCPWM_TIMER_0, MCPWM_SELECT_F0,
+                             MCPWM_FORCE_MA0_LOW, MCPWM_FORCE_MB0_LOW);
+}
+
+// Retune the carrier once the bytes already queued have left, so no byte is
+// split across two carriers.
+void setCarrierChannel(int ch) {
+    if (ch < 0 || ch >= CARRIER_CHANNELS) return;
+#if IR_TX_UART
+    IRSerial.flush();
+    mcpwm_set_frequency(MCPWM_UNIT_0, MCPWM_TIMER_0, CARRIER_HZ[ch]);
+    mcpwm_set_duty(MCPWM_UNIT_0, MCPWM_TIMER_0, MCPWM_OPR_A, 50.0);
+#else
+    ledcChangeFrequency(pwmChannel, CARRIER_HZ[ch], pwmResolution);
+#endif
+    carrierChannel = ch;
+}
+
+// Queue bytes for transmission. In UART mode this only copies into the
+// driver's TX buffer and returns; the FIFO is refilled by the UART ISR.
+void sendBytes(const uint8_t* data, size_t len) {
+#if IR_TX_UART
+    IRSerial.write(data, len);
+#else
+    for (size_t i = 0; i < len; i++) sendByte(data[i]);
+#endif
+}
+
 void setup() {
     // Initialize M5Unified system
     auto cfg = M5.config();
     M5.begin(cfg);
 
-    // Set up PWM on IR_LED_PIN
-    ledcSetup(pwmChannel, pwmFreq, pwmResolution);
-    ledcAttachPin(IR_LED_PIN, pwmChannel);
-
     // Set up display
     M5.Lcd.setTextSize(2);
     M5.Lcd.setTextColor(WHITE, BLACK);
 
-    IRSerial.begin(2400, SERIAL_8N1, IR_RX_PIN, -1);
+#if IR_TX_UART
+    setupUartCarrier();
+
+    IRSerial.setTxBufferSize(256);
+    IRSerial.begin(irBaud, SERIAL_8N1, IR_RX_PIN, IR_TX_LOOP_PIN);
+    // Attaching TXD made the loop pad output-only; re-enable its input so
+    // the fault input sees the level the UART drives onto it.
+    PIN_INPUT_ENABLE(GPIO_PIN_MUX_REG[IR_TX_LOOP_PIN]);
+#else
+    // Set up PWM on IR_LED_PIN
+    ledcSetup(pwmChannel, CARRIER_HZ[carrierChannel], pwmResolution);
+    ledcAttachPin(IR_LED_PIN, pwmChannel);
+
+    IRSerial.begin(irBaud, SERIAL_8N1, IR_RX_PIN, -1);
+#endif
     Serial.begin(115200);  // USB debug
 }
 
@@ -76,9 +147,13 @@ void loop() {
 
     if (M5.BtnA.wasPressed()) {
         M5.Lcd.println("Sending IR signal");
-        sendByte(148);
-        sendByte(185);
-        sendByte(63);
+        const uint8_t msg[] = { 148, 185, 63 };
+        sendBytes(msg, sizeof(msg));
+    }
+
+    else if (M5.BtnB.wasPressed()) {
+        setCarrierChannel((carrierChannel + 1) % CARRIER_CHANNELS);
+        M5.Lcd.printf("Carrier %lu kHz\n", (unsigned long)(CARRIER_HZ[carrierChannel] / 1000));
     }
 
     else if (IRSerial.available()) {
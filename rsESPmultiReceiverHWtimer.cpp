@@ -0,0 +1,395 @@
+//This code is for the ESP-IDF framework.
+//It is a receiver for several IR demodulators on different GPIOs, all decoded by one hardware timer.
+//Every sensor runs its own UART + "ZT" state machine, and the sensors that hear a MAC give its direction.
+//Each sensor is tied to the carrier channel its demodulator is tuned to, so several channels can be received at once.
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "driver/gpio.h"
+#include "driver/gptimer.h"
+#include "esp_system.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "soc/gpio_reg.h"
+#include "M5GFX.h"
+
+#define BAUD_RATE 2400
+#define OVERSAMPLE 4 // sample ticks per bit; fixed, the lane phase counter is 2 bits
+#define TICK_HZ (BAUD_RATE * OVERSAMPLE)
+#define TICK_US (1000000 / TICK_HZ)  // whole µs per tick
+#define TICK_REM (1000000 % TICK_HZ) // fractional part, in 1/TICK_HZ µs
+
+#define SYNC1 0x5A // 'Z'
+#define SYNC2 0x54 // 'T'
+
+// Carrier channels, one per common demodulator centre frequency
+#define CARRIER_CHANNELS 6
+static const uint32_t CARRIER_HZ[CARRIER_CHANNELS] = { 30000, 33000, 36000, 38000, 40000, 56000 };
+
+// Sensors, the direction each one faces in degrees, and the channel of its
+// demodulator (fit e.g. a 56 kHz part and set its entry to 5). Bearings are
+// only formed from sensors on the same channel.
+// Not 37/38/39: those are the M5Stack buttons and would inject start bits.
+#define NUM_SENSORS 4
+static const gpio_num_t SENSOR_GPIOS[NUM_SENSORS] = { GPIO_NUM_36, GPIO_NUM_13, GPIO_NUM_34, GPIO_NUM_35 };
+static const float SENSOR_ANGLE_DEG[NUM_SENSORS] = { 0, 90, 180, 270 };
+static const uint8_t SENSOR_CHANNEL[NUM_SENSORS] = { 3, 3, 3, 3 }; // 38 kHz
+
+// Copies of one beacon heard by several sensors arrive within this window
+#define DOA_WINDOW_US 50000
+#define FRAME_QUEUE_LEN 32
+
+// Bit-sliced lanes: lane n is GPIO n, so GPIO_IN_REG / GPIO_IN1_REG map onto
+// a lane word with no per-sensor shuffling.
+typedef uint64_t lanes_t;
+
+// Per-lane receive shift register, one word per bit position. A sentinel is
+// loaded into the top word at the start edge and each sample shifts it down
+// one word; when it reaches word 0 the lane holds start, 8 data and stop bits
+// in words 1..10.
+#define SHIFT_WORDS 11
+
+M5GFX display;
+
+uint8_t mac_self[6];
+
+gptimer_handle_t gptimer = NULL;
+static uint32_t tickPhaseRem = 0; // fractional tick clock accumulator
+
+// Bit-sliced UART state, owned by the sample ISR
+static DRAM_ATTR lanes_t sensorMask = 0;    // lanes that have a sensor
+static DRAM_ATTR lanes_t busy = 0;          // lanes inside a byte
+static DRAM_ATTR lanes_t fresh = 0;         // busy lanes whose start bit is not sampled yet
+static DRAM_ATTR lanes_t phase0 = 0;        // 2-bit oversample phase, low bit
+static DRAM_ATTR lanes_t phase1 = 0;        // 2-bit oversample phase, high bit
+static DRAM_ATTR lanes_t shiftReg[SHIFT_WORDS];
+static DRAM_ATTR int8_t laneSensor[64];     // lane -> sensor index
+
+// Per-sensor ZT parser and statistics
+typedef struct {
+    uint8_t syncState;
+    uint8_t macIndex;
+    uint8_t mac[6];
+    uint32_t bytes;
+    uint32_t frames;
+    uint32_t framingErrors;
+} sensor_state_t;
+
+static DRAM_ATTR sensor_state_t sensors[NUM_SENSORS];
+
+typedef struct {
+    int64_t time_us;
+    uint8_t sensor;
+    uint8_t mac[6];
+} sensor_frame_t;
+
+static QueueHandle_t frameQueue = NULL;
+
+// Sample ISR cost, in CPU cycles
+volatile uint32_t isrCycles = 0;
+volatile uint32_t isrCyclesMax = 0;
+volatile uint32_t isrCalls = 0;
+
+// ----------------------
+// Fractional tick clock
+// ----------------------
+static inline uint32_t IRAM_ATTR next_tick_step() {
+    uint32_t step = TICK_US;
+    tickPhaseRem += TICK_REM;
+    if (tickPhaseRem >= TICK_HZ) {
+        tickPhaseRem -= TICK_HZ;
+        step++;
+    }
+    return step;
+}
+
+// ----------------------
+// Per-sensor ZT parser
+// ----------------------
+// Only runs when a lane completes a byte, i.e. at most once per bit time
+// per sensor, so it stays scalar.
+static void IRAM_ATTR sensor_feed_byte(int idx, uint8_t byte, BaseType_t *woken) {
+    sensor_state_t *st = &sensors[idx];
+    st->bytes++;
+
+    if (st->syncState == 0 && byte == SYNC1) {
+        st->syncState = 1;
+    }
+    else if (st->syncState == 1 && byte == SYNC2) {
+        st->syncState = 2;
+        st->macIndex = 0;
+    }
+    else if (st->syncState == 2) {
+        st->mac[st->macIndex++] = byte;
+        if (st->macIndex >= 6) {
+            st->frames++;
+            st->syncState = 0;
+
+            sensor_frame_t frame;
+            frame.time_us = esp_timer_get_time();
+            frame.sensor = idx;
+            memcpy(frame.mac, st->mac, 6);
+            xQueueSendFromISR(frameQueue, &frame, woken);
+        }
+    }
+    else {
+        st->syncState = 0;
+    }
+}
+
+static inline uint8_t IRAM_ATTR lane_byte(int lane) {
+    uint8_t byte = 0;
+    for (int k = 0; k < 8; k++) {
+        byte |= ((shiftReg[2 + k] >> lane) & 1) << k;
+    }
+    return byte;
+}
+
+// ----------------------
+// Timer ISR: one sample tick for every lane
+// ----------------------
+// The whole input register is read once, then every sensor's UART state
+// machine advances with a fixed number of word-wide operations, so the cost
+// barely depends on how many sensors there are. Per-lane work only happens
+// for lanes that just finished a byte.
+static bool IRAM_ATTR on_sample_tick(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void*) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    BaseType_t woken = pdFALSE;
+
+    lanes_t in = ((lanes_t)REG_READ(GPIO_IN1_REG) << 32) | REG_READ(GPIO_IN_REG);
+    in &= sensorMask;
+
+    gptimer_alarm_config_t next_alarm = {
+        .alarm_count = edata->alarm_value + next_tick_step()
+    };
+    gptimer_set_alarm_action(timer, &next_alarm);
+
+    // Advance the oversample phase of busy lanes; phase 2 is mid-bit
+    phase1 ^= phase0 & busy;
+    phase0 ^= busy;
+    lanes_t sample = busy & phase1 & ~phase0;
+
+    if (sample) {
+        for (int j = 0; j < SHIFT_WORDS - 1; j++) {
+            shiftReg[j] = (shiftReg[j] & ~sample) | (shiftReg[j + 1] & sample);
+        }
+        shiftReg[SHIFT_WORDS - 1] = (shiftReg[SHIFT_WORDS - 1] & ~sample) | (in & sample);
+
+        // Start bit sampled high: it was a glitch, go back to idle
+        busy &= ~(sample & fresh & in);
+        fresh &= ~sample;
+
+        lanes_t done = busy & shiftReg[0];
+        if (done) {
+            busy &= ~done;
+            lanes_t good = done & ~shiftReg[1] & shiftReg[SHIFT_WORDS - 1];
+            lanes_t bad = done & ~good;
+
+            while (good) {
+                int lane = __builtin_ctzll(good);
+                good &= good - 1;
+                sensor_feed_byte(laneSensor[lane], lane_byte(lane), &woken);
+            }
+            while (bad) {
+                int lane = __builtin_ctzll(bad);
+                bad &= bad - 1;
+                sensors[laneSensor[lane]].framingErrors++;
+                sensors[laneSensor[lane]].syncState = 0;
+            }
+        }
+    }
+
+    // Idle lanes seeing a low level have a start bit: phase 0 now, first
+    // sample (start bit centre) two ticks later, then every OVERSAMPLE ticks.
+    lanes_t starting = ~busy & ~in & sensorMask;
+    if (starting) {
+        busy |= starting;
+        fresh |= starting;
+        phase0 &= ~starting;
+        phase1 &= ~starting;
+        for (int j = 0; j < SHIFT_WORDS - 1; j++) shiftReg[j] &= ~starting;
+        shiftReg[SHIFT_WORDS - 1] |= starting; // sentinel
+    }
+
+    uint32_t cycles = esp_cpu_get_cycle_count() - start;
+    isrCycles += cycles;
+    isrCalls++;
+    if (cycles > isrCyclesMax) isrCyclesMax = cycles;
+
+    return woken == pdTRUE;
+}
+
+// ----------------------
+// Compare received MAC to own
+// ----------------------
+bool isOwnMAC(const uint8_t *mac) {
+    return memcmp(mac, mac_self, 6) == 0;
+}
+
+// ----------------------
+// Sensor setup
+// ----------------------
+void setup_sensors() {
+    memset(laneSensor, -1, sizeof(laneSensor));
+
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 0,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE
+    };
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        io_conf.pin_bit_mask |= 1ULL << SENSOR_GPIOS[i];
+        sensorMask |= (lanes_t)1 << SENSOR_GPIOS[i];
+        laneSensor[SENSOR_GPIOS[i]] = i;
+    }
+    gpio_config(&io_conf);
+}
+
+// ----------------------
+// Timer setup
+// ----------------------
+void setup_gptimer() {
+    gptimer_config_t timer_config = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = 1000000 // 1 MHz
+    };
+    ESP_ERROR_CHECK(gptimer_new_timer(&timer_config, &gptimer));
+
+    gptimer_event_callbacks_t cbs = {
+        .on_alarm = on_sample_tick
+    };
+    ESP_ERROR_CHECK(gptimer_register_event_callbacks(gptimer, &cbs, NULL));
+
+    // One-shot alarms re-armed from the ISR so the fractional tick applies
+    gptimer_alarm_config_t alarm_config = {
+        .alarm_count = next_tick_step()
+    };
+    ESP_ERROR_CHECK(gptimer_set_alarm_action(gptimer, &alarm_config));
+
+    ESP_ERROR_CHECK(gptimer_enable(gptimer));
+    ESP_ERROR_CHECK(gptimer_start(gptimer));
+}
+
+// ----------------------
+// Direction of arrival
+// ----------------------
+// Average of the facing directions of every sensor that decoded the frame,
+// as unit vectors. Returns the bearing in degrees [0, 360).
+float estimate_bearing(uint32_t sensorHits) {
+    float x = 0, y = 0;
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        if (sensorHits & (1u << i)) {
+            float rad = SENSOR_ANGLE_DEG[i] * (float)M_PI / 180.0f;
+            x += cosf(rad);
+            y += sinf(rad);
+        }
+    }
+    float deg = atan2f(y, x) * 180.0f / (float)M_PI;
+    return deg < 0 ? deg + 360.0f : deg;
+}
+
+void report_frame(int channel, const uint8_t *mac, uint32_t sensorHits) {
+    float bearing = estimate_bearing(sensorHits);
+
+    printf("Received MAC: %02X:%02X:%02X:%02X:%02X:%02X on %lu kHz, sensors 0x%02lX bearing %.0f deg\n",
+           mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+           (unsigned long)(CARRIER_HZ[channel] / 1000), (unsigned long)sensorHits, bearing);
+
+    display.fillScreen(TFT_BLACK);
+    display.setCursor(0, 0);
+    display.printf("Recv MAC: %02X:%02X:%02X:%02X:%02X:%02X\n",
+                   mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    display.printf("%lu kHz, bearing %.0f deg\n", (unsigned long)(CARRIER_HZ[channel] / 1000), bearing);
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        display.printf("S%d %c fr %lu err %lu\n", i,
+                       (sensorHits & (1u << i)) ? '*' : ' ',
+                       (unsigned long)sensors[i].frames,
+                       (unsigned long)sensors[i].framingErrors);
+    }
+}
+
+// ----------------------
+// Main app
+// ----------------------
+extern "C" void app_main(void) {
+    // LCD
+    display.begin();
+    display.setTextColor(TFT_WHITE, TFT_BLACK);
+    display.setTextSize(2);
+    display.fillScreen(TFT_BLACK);
+    display.setCursor(0, 0);
+    display.println("IR Multi-Receiver");
+
+    // Read our MAC
+    esp_read_mac(mac_self, ESP_MAC_WIFI_STA);
+
+    frameQueue = xQueueCreate(FRAME_QUEUE_LEN, sizeof(sensor_frame_t));
+    setup_sensors();
+    setup_gptimer();
+
+    // Group the copies of one beacon that different sensors on the same
+    // channel decoded; channels are independent links.
+    uint8_t groupMac[CARRIER_CHANNELS][6];
+    uint32_t groupHits[CARRIER_CHANNELS] = {};
+    int64_t groupStart[CARRIER_CHANNELS] = {};
+    uint32_t channelFrames[CARRIER_CHANNELS] = {};
+    int64_t lastStats = 0;
+
+    while (1) {
+        sensor_frame_t frame;
+        if (xQueueReceive(frameQueue, &frame, pdMS_TO_TICKS(10))) {
+            int ch = SENSOR_CHANNEL[frame.sensor];
+            if (isOwnMAC(frame.mac)) {
+                printf("Ignored: Own MAC received on sensor %d.\n", frame.sensor);
+            }
+            else if (groupHits[ch] && memcmp(frame.mac, groupMac[ch], 6) == 0 &&
+                     frame.time_us - groupStart[ch] < DOA_WINDOW_US) {
+                groupHits[ch] |= 1u << frame.sensor;
+            }
+            else {
+                if (groupHits[ch]) report_frame(ch, groupMac[ch], groupHits[ch]);
+                memcpy(groupMac[ch], frame.mac, 6);
+                groupHits[ch] = 1u << frame.sensor;
+                groupStart[ch] = frame.time_us;
+                channelFrames[ch]++;
+            }
+        }
+
+        int64_t now = esp_timer_get_time();
+        for (int ch = 0; ch < CARRIER_CHANNELS; ch++) {
+            if (groupHits[ch] && now - groupStart[ch] >= DOA_WINDOW_US) {
+                report_frame(ch, groupMac[ch], groupHits[ch]);
+                groupHits[ch] = 0;
+            }
+        }
+
+        if (now - lastStats >= 5000000) {
+            lastStats = now;
+            if (isrCalls) {
+                printf("Sample ISR: avg %lu cycles, max %lu cycles, %d sensors\n",
+                       (unsigned long)(isrCycles / isrCalls),
+                       (unsigned long)isrCyclesMax, NUM_SENSORS);
+            }
+            for (int ch = 0; ch < CARRIER_CHANNELS; ch++) {
+                if (channelFrames[ch]) {
+                    printf("  %lu kHz: %lu beacons\n", (unsigned long)(CARRIER_HZ[ch] / 1000),
+                           (unsigned long)channelFrames[ch]);
+                }
+            }
+            for (int i = 0; i < NUM_SENSORS; i++) {
+                printf("  S%d GPIO%d %lu kHz: %lu bytes, %lu frames, %lu framing errors\n",
+                       i, SENSOR_GPIOS[i], (unsigned long)(CARRIER_HZ[SENSOR_CHANNEL[i]] / 1000),
+                       (unsigned long)sensors[i].bytes,
+                       (unsigned long)sensors[i].frames,
+                       (unsigned long)sensors[i].framingErrors);
+            }
+        }
+    }
+}
@@ -0,0 +1,2239 @@
+//This code is for the ESP-IDF framework.
+//It is a full IR node that sends (GPIO 26, LEDC + hardware timer) and receives (GPIO 36, hardware timer) on one unit.
+//Besides the "ZT" + MAC beacon it carries typed, CRC-checked frames, used for bulk transfers with a sliding-window ARQ
+//and for ping/echo link measurements (RTT percentiles, loss and reordering).
+//With RELAY_MODE set, beacons are flooded across several hops: every node rebroadcasts them once, with a TTL.
+//With SHORT_ADDR_MODE set, a node announces its MAC once and then beacons with a 1-byte short address (3 bytes on air).
+//The link (ISRs, decoding, protocols) runs on one core and the UI (display, buttons, serial) on the other;
+//they talk only through two single-producer/single-consumer rings.
+//With LOW_POWER_MODE set, the chip light-sleeps whenever the link is idle, woken by the IR line, a button or its next timer.
+//Every peer sighting is appended to a ring log in the "sightings" flash partition, so it survives a reboot.
+//Baud rate and beacon period can be switched fleet-wide by control frames from a coordinator node, within what the 38 kHz demodulator passes.
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "driver/ledc.h"
+#include "driver/gpio.h"
+#include "driver/gptimer.h"
+#include "driver/uart.h"
+#include "esp_system.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
+#include "esp_sleep.h"
+#include "esp_partition.h"
+#include "esp_rom_gpio.h"
+#include "soc/gpio_reg.h"
+#include "soc/gpio_sig_map.h"
+#include "M5GFX.h"
+
+#define IR_TX_GPIO GPIO_NUM_26
+#define IR_RX_GPIO GPIO_NUM_36
+#define BUTTON_A_GPIO GPIO_NUM_39 // send a ZT beacon
+#define BUTTON_B_GPIO GPIO_NUM_38 // send the ARQ test blob
+#define BUTTON_C_GPIO GPIO_NUM_37 // start / stop ping mode; on the coordinator, broadcast the next preset
+
+#define BAUD_RATE_DEFAULT 2400 // until a control frame says otherwise
+#define FRAME_GAP_BITS 24 // edge-free bit times that end a half-received frame
+
+#define LEDC_CHANNEL LEDC_CHANNEL_0
+#define LEDC_TIMER   LEDC_TIMER_0
+#define LEDC_RES     LEDC_TIMER_8_BIT
+#define IR_TX_OUT_SEL_REG (GPIO_FUNC0_OUT_SEL_CFG_REG + 4 * IR_TX_GPIO)
+
+// Carrier channels. Adjacent ones overlap in a demodulator's passband; only 30 vs 56 kHz are reliably separated.
+#define CARRIER_CHANNELS 6
+static const uint32_t CARRIER_HZ[CARRIER_CHANNELS] = { 30000, 33000, 36000, 38000, 40000, 56000 };
+#define CARRIER_CHANNEL_DEFAULT 3 // 38 kHz, to match the demodulator on IR_RX_GPIO
+
+#define TX_QUEUE_LEN 8  // frames; power of two
+#define TX_FRAME_MAX 64 // bytes per frame on air
+#define RX_QUEUE_LEN 8  // decoded frames waiting for the link task
+
+// --- Task layout ---
+// ISRs are allocated on the core that installs them, so the link task does
+// its own timer and GPIO setup.
+#define PIPELINE_PINNED 1 // 0: both tasks unpinned at equal priority (baseline for the jitter figures)
+#define LINK_CORE 1
+#define UI_CORE 0
+#define LINK_TASK_PRIO (configMAX_PRIORITIES - 2)
+#define UI_TASK_PRIO 2
+#define UI_STRESS 0        // 1: UI task redraws the whole screen non-stop, to load its core
+#define UI_RING_LEN 32     // log lines link -> UI; power of two
+#define LOG_UI_RING_LEN 8  // log lines sightings log -> UI; power of two
+#define UI_MSG_LEN 192
+#define CMD_RING_LEN 8     // button commands UI -> link; power of two
+#define JITTER_REPORT_US 5000000
+
+// --- Low power ---
+// A sleeping receiver loses the edges that wake it, so every frame sent after
+// an idle line is led by 0xFF bytes: one falling edge each, nothing the framer
+// can mistake for 'Z'. All nodes of a low-power network need the same setting.
+#define LOW_POWER_MODE 0
+#define WAKE_PREAMBLE_BYTES (LOW_POWER_MODE ? 2 : 0) // 8.3 ms at 2400 baud, light-sleep wakeup is ~1 ms
+#define LOW_POWER_BEACON_US 10000000 // timer-woken beacon period
+#define SLEEP_MIN_US 2000            // not worth sleeping for less
+#define SLEEP_MAX_US 1000000
+
+// --- Sightings log ---
+// Needs a data partition in the partition table, e.g.
+//   sightings, data, 0x40, , 64K
+// Record: seq[4] time_ms[4] mac[6] hops[1] crc8[1], written in sequence
+// through the partition and wrapping round, one 4 KB sector erased ahead
+// while the link is quiet. time_ms is uptime and restarts at 0 every boot, so
+// only seq orders the log.
+#define LOG_PARTITION "sightings"
+#define LOG_REC_SIZE 16
+#define LOG_SECTOR 4096
+#define LOG_RECS_PER_SECTOR (LOG_SECTOR / LOG_REC_SIZE)
+#define LOG_BATCH 16          // records per flash write: one 256-byte page
+#define LOG_FLUSH_US 5000000  // a partial batch is written after this long
+#define LOG_RING_LEN 64       // sightings link -> log task; power of two
+#define LOG_TASK_PRIO 1
+#define LOG_SHOW_AT_BOOT 5
+
+// --- Control frames ---
+// CONTROL payload: origin mac[6] epoch[1] baud[4] channel[1] line_code[1]
+//                  beacon_ms[4] switch_in_ms[2]
+// switch_in_ms counts from the end of the frame carrying it, so each repeat
+// re-states the same switch instant.
+#define COORDINATOR 0              // 1: button C broadcasts the next entry of CTRL_PRESETS
+#define CTRL_LEN 19
+#define CTRL_LEAD_US 2000000       // announce this far ahead of the switch
+#define CTRL_REPEATS 3             // copies of each announcement
+#define CTRL_REPEAT_GAP_US 400000
+#define CTRL_FALLBACK_US 30000000  // no frame decoded this long after a switch: go back
+#define LINE_UART_NRZ 0            // 8N1, carrier on for 0 bits; the only line code implemented
+
+// --- Frame format ---
+// Beacon (legacy, unchanged):  'Z' 'T' mac[6]
+// Short beacon:                'Z' 'S' addr   (addr: 7-bit short address, bit 7 = even parity)
+// Typed frame:                 'Z' type len payload[len] crc8(type, len, payload)
+#define SYNC1 0x5A // 'Z'
+#define SYNC2 0x54 // 'T'
+#define SHORT_BEACON 0x53 // 'S'
+#define FRAME_DATA 0x44 // 'D': ARQ fragment
+#define FRAME_ACK  0x4B // 'K': ARQ selective acknowledgement
+#define FRAME_PING 0x50 // 'P': ping request
+#define FRAME_ECHO 0x45 // 'E': ping reply, the request payload sent back unchanged
+#define FRAME_FLOOD 0x46 // 'F': beacon flooded over several hops
+#define FRAME_ANNOUNCE 0x41 // 'A': full MAC and the short address standing in for it
+#define FRAME_CONTROL 0x43 // 'C': link settings to switch to at an announced time
+#define FRAME_OVERHEAD 4 // 'Z', type, len, crc
+#define FRAME_PAYLOAD_MAX (TX_FRAME_MAX - FRAME_OVERHEAD)
+
+// --- ARQ transport ---
+// DATA payload: src mac[6] xfer seq nfrags data[<= ARQ_FRAG_SIZE]
+// ACK payload:  dst mac[6] xfer cum sack[4]
+//   cum  = number of fragments received in order from 0
+//   sack = bit i set if fragment cum + 1 + i was also received
+#define ARQ_FRAG_SIZE 32
+// The line is half duplex, so every ACK costs a quiet slot (~110 ms at 2400
+// baud) against 190 ms per fragment: 8 fragments per slot give 53% of the
+// baud rate as goodput, 4 only 50%. The window is two slots deep so a lost
+// ACK or fragment does not stop the next run of 8.
+#define ARQ_WINDOW 16   // fragments in flight; more than the TX queue holds
+#define ARQ_ACK_EVERY 8 // fragments between ACK slots
+#define ARQ_MAX_BYTES 4096
+#define ARQ_MAX_FRAGS (ARQ_MAX_BYTES / ARQ_FRAG_SIZE)
+#define ARQ_DATA_HDR 9
+#define ARQ_ACK_LEN 12
+#define ARQ_ACK_IDLE_US 30000   // line idle this long after data: ACK slot, send ACK
+#define ARQ_ACK_WAIT_US 250000  // ACK allowance after our last fragment has left
+#define ARQ_MAX_RETRIES 10
+#define ARQ_TEST_BYTES 2048
+
+// --- Ping ---
+// PING/ECHO payload: origin mac[6] seq[2] timestamp_us[4] (origin's esp_timer, low 32 bits)
+#define PING_LEN 12
+#define PING_INTERVAL_US 500000
+#define PING_TIMEOUT_US 2000000 // an echo later than this counts as lost
+#define PING_SAMPLES 256        // RTT samples kept for percentiles
+#define PING_REPORT_EVERY 10    // pings between reports
+
+// --- Flooding relay ---
+// FLOOD payload: origin mac[6] seq[2] ttl[1] hops[1]
+#define RELAY_MODE 0           // 1: beacons are flooded and relayed, 0: legacy one-hop ZT beacons
+#define FLOOD_LEN 10
+#define FLOOD_TTL 4            // hops a beacon may travel
+#define FLOOD_JITTER_US 200000 // relay delay is random in [0, FLOOD_JITTER_US)
+#define FLOOD_SUPPRESS 2       // copies overheard while waiting that cancel our relay
+#define FLOOD_CACHE_SIZE 32    // (origin, seq) pairs remembered
+#define FLOOD_CACHE_US 10000000 // cache entries expire after this
+#define FLOOD_PENDING 4        // relays waiting for their delay
+
+// --- Short addresses ---
+// ANNOUNCE payload: mac[6] short[1]
+#define SHORT_ADDR_MODE 0        // 1: button A sends short beacons (takes precedence over RELAY_MODE)
+#define ANNOUNCE_LEN 7
+#define SHORT_ADDRS 128          // 7-bit address space, one peer table slot each
+#define SHORT_ANNOUNCE_EVERY 32  // short beacons between re-announcements, for late joiners
+#define PEER_EXPIRE_US 300000000 // a short address is free again after 5 min of silence
+
+// --- TX queue ---
+// Called from the bit ISR once the stop bit of the frame's last byte is on air.
+typedef void (*tx_done_cb_t)(uint32_t frame_id, void *user_ctx);
+
+typedef struct {
+    uint8_t data[TX_FRAME_MAX];
+    uint8_t len;
+    uint32_t id;
+    tx_done_cb_t done_cb;
+    void *user_ctx;
+} tx_frame_t;
+
+// Single-producer (main loop) / single-consumer (bit ISR) ring.
+static tx_frame_t txQueue[TX_QUEUE_LEN];
+static volatile uint32_t txHead = 0;
+static volatile uint32_t txTail = 0;
+static volatile bool txHold = false; // finish the frame on air, start no more
+static uint32_t nextFrameId = 0;
+
+// --- RX frames ---
+typedef struct {
+    int64_t time_us; // when the last byte was decoded
+    uint8_t type;
+    uint8_t len;
+    uint8_t payload[FRAME_PAYLOAD_MAX];
+    uint8_t crc;
+} rx_frame_t;
+
+enum { RX_HUNT, RX_TYPE, RX_LEN, RX_PAYLOAD, RX_CRC };
+
+// --- Globals ---
+M5GFX display;
+static int carrierChannel = CARRIER_CHANNEL_DEFAULT;
+
+// Line rate, read by both bit clocks; changed only by apply_link_cfg()
+volatile uint32_t baudRate = BAUD_RATE_DEFAULT;
+volatile uint32_t bitDurationUs = 1000000 / BAUD_RATE_DEFAULT;  // whole µs per bit
+volatile uint32_t bitDurationRem = 1000000 % BAUD_RATE_DEFAULT; // fractional part, in 1/baudRate µs
+uint8_t mac_self[6];
+uint8_t beacon[8]; // 2-byte preamble + 6-byte MAC
+
+// TX state, owned by whoever wins the CAS on 'transmitting'
+volatile bool transmitting = false;
+volatile int txBitIndex = 0;
+volatile int txByteIndex = 0;
+volatile uint8_t txByte = 0;
+volatile uint32_t txPhaseRem = 0;
+gptimer_handle_t tx_timer = NULL;
+
+static DRAM_ATTR uint32_t carrierOnSel = 0;  // IR pin routed to the LEDC channel
+static DRAM_ATTR uint32_t carrierOffSel = 0; // IR pin routed to GPIO_OUT, held low
+
+// RX state, owned by the edge and sample ISRs
+volatile bool receiving = false;
+volatile int rxBitIndex = -1;
+volatile uint8_t rxByte = 0;
+volatile uint32_t rxPhaseRem = 0;
+volatile uint32_t samplePeriod = 0;
+volatile int64_t armEdgeUs = 0;
+volatile int64_t lastEdgeUs = 0;
+gptimer_handle_t rx_timer = NULL;
+
+// Receive-path jitter, reset at each report
+static volatile uint32_t sampleLateMax = 0; // sample ISR entry after its alarm, µs
+static volatile uint32_t sampleLateSum = 0;
+static volatile uint32_t sampleLateCount = 0;
+static portMUX_TYPE sampleLateMux = portMUX_INITIALIZER_UNLOCKED; // the three above, read and reset together
+static uint32_t dispatchMax = 0;            // frame decoded -> handled by the link task, µs
+static uint64_t dispatchSum = 0;
+static uint32_t dispatchCount = 0;
+static volatile uint32_t rxQueueFull = 0;   // decoded frames lost, link task behind
+
+static volatile int rxState = RX_HUNT;
+static int rxIndex = 0;
+static rx_frame_t rxFrame;
+static QueueHandle_t rxQueue = NULL;
+
+// --- CRC-8 (poly 0x07) ---
+static uint8_t crc8(uint8_t crc, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static inline bool is_typed_frame(uint8_t type)
+{
+    switch (type) {
+    case FRAME_DATA:
+    case FRAME_ACK:
+    case FRAME_PING:
+    case FRAME_ECHO:
+    case FRAME_FLOOD:
+    case FRAME_ANNOUNCE:
+    case FRAME_CONTROL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// ======================================================================
+// Transmitter
+// ======================================================================
+
+// bitDurationUs or +1 tick, so the average period is exact
+static inline uint32_t IRAM_ATTR next_tx_step()
+{
+    uint32_t step = bitDurationUs;
+    txPhaseRem += bitDurationRem;
+    if (txPhaseRem >= baudRate) {
+        txPhaseRem -= baudRate;
+        step++;
+    }
+    return step;
+}
+
+static inline void IRAM_ATTR carrier_gate(bool on)
+{
+    REG_WRITE(IR_TX_OUT_SEL_REG, on ? carrierOnSel : carrierOffSel);
+}
+
+static inline bool IRAM_ATTR claim_transmitter()
+{
+    bool idle = false;
+    return __atomic_compare_exchange_n(&transmitting, &idle, true, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static bool IRAM_ATTR on_tx_timer(gptimer_handle_t timer,
+                                  const gptimer_alarm_event_data_t *edata,
+                                  void *user_ctx)
+{
+    if (!transmitting) return false;
+
+    bool bit;
+    if (txBitIndex == 0) { // Start bit
+        bit = 0;
+    } else if (txBitIndex <= 8) { // Data bits (LSB first)
+        bit = (txByte >> (txBitIndex - 1)) & 0x01;
+    } else { // Stop bit
+        bit = 1;
+    }
+    carrier_gate(bit == 0);
+
+    txBitIndex++;
+    if (txBitIndex > 9) { // Next byte
+        tx_frame_t *frame = &txQueue[txTail % TX_QUEUE_LEN];
+        txBitIndex = 0;
+        txByteIndex++;
+        if (txByteIndex < 0) {
+            txByte = 0xFF; // wake preamble
+        } else if (txByteIndex < frame->len) {
+            txByte = frame->data[txByteIndex];
+        } else {
+            // Frame done: chain straight into the next queued frame
+            if (frame->done_cb) frame->done_cb(frame->id, frame->user_ctx);
+            __atomic_store_n(&txTail, txTail + 1, __ATOMIC_RELEASE);
+
+            if (txHold || __atomic_load_n(&txHead, __ATOMIC_ACQUIRE) == txTail) {
+                __atomic_store_n(&transmitting, false, __ATOMIC_SEQ_CST);
+                if (txHold || __atomic_load_n(&txHead, __ATOMIC_SEQ_CST) == txTail ||
+                    !claim_transmitter()) {
+                    carrier_gate(false);
+                    return false;
+                }
+            }
+
+            txByteIndex = 0;
+            txByte = txQueue[txTail % TX_QUEUE_LEN].data[0];
+        }
+    }
+
+    gptimer_alarm_config_t next_alarm = {
+        .alarm_count = edata->alarm_value + next_tx_step()
+    };
+    gptimer_set_alarm_action(timer, &next_alarm);
+    return false;
+}
+
+// Start the bit clock on the oldest queued frame. The caller has claimed the
+// transmitter.
+static void tx_start()
+{
+    txBitIndex = 0;
+    txByteIndex = -WAKE_PREAMBLE_BYTES;
+    txByte = WAKE_PREAMBLE_BYTES ? 0xFF : txQueue[txTail % TX_QUEUE_LEN].data[0];
+    txPhaseRem = 0;
+
+    uint64_t now = 0;
+    gptimer_get_raw_count(tx_timer, &now);
+    gptimer_alarm_config_t first_alarm = {
+        .alarm_count = now + next_tx_step()
+    };
+    gptimer_set_alarm_action(tx_timer, &first_alarm);
+}
+
+// Queue raw bytes for transmission. Returns the frame id, or -1 if the queue
+// is full or the frame too long. Main loop only.
+int32_t send_frame(const uint8_t *data, size_t len, tx_done_cb_t done_cb, void *user_ctx)
+{
+    if (len == 0 || len > TX_FRAME_MAX) return -1;
+
+    uint32_t head = txHead;
+    if (head - __atomic_load_n(&txTail, __ATOMIC_ACQUIRE) >= TX_QUEUE_LEN) return -1;
+
+    tx_frame_t *frame = &txQueue[head % TX_QUEUE_LEN];
+    memcpy(frame->data, data, len);
+    frame->len = len;
+    frame->id = nextFrameId++;
+    frame->done_cb = done_cb;
+    frame->user_ctx = user_ctx;
+    __atomic_store_n(&txHead, head + 1, __ATOMIC_SEQ_CST);
+
+    if (!txHold && claim_transmitter()) tx_start();
+    return frame->id;
+}
+
+// Wrap a payload as a typed frame and queue it
+int32_t send_typed(uint8_t type, const uint8_t *payload, size_t len)
+{
+    if (len > FRAME_PAYLOAD_MAX) return -1;
+
+    uint8_t buf[TX_FRAME_MAX];
+    buf[0] = SYNC1;
+    buf[1] = type;
+    buf[2] = len;
+    memcpy(&buf[3], payload, len);
+    buf[3 + len] = crc8(0, &buf[1], len + 2);
+    return send_frame(buf, len + FRAME_OVERHEAD, NULL, NULL);
+}
+
+static inline bool tx_queue_empty()
+{
+    return txHead == __atomic_load_n(&txTail, __ATOMIC_ACQUIRE);
+}
+
+// Airtime of a frame of 'len' bytes, start and stop bits included
+static inline int64_t frame_airtime_us(size_t len)
+{
+    return (int64_t)len * 10 * 1000000 / baudRate;
+}
+
+// Link task only. Waits out the frame on air so none spans two carriers.
+void set_carrier_channel(int ch)
+{
+    if (ch < 0 || ch >= CARRIER_CHANNELS) return;
+    while (transmitting) vTaskDelay(pdMS_TO_TICKS(1));
+    ESP_ERROR_CHECK(ledc_set_freq(LEDC_HIGH_SPEED_MODE, LEDC_TIMER, CARRIER_HZ[ch]));
+    carrierChannel = ch;
+}
+
+// ======================================================================
+// Receiver
+// ======================================================================
+
+static inline uint32_t IRAM_ATTR next_rx_step()
+{
+    uint32_t step = bitDurationUs;
+    rxPhaseRem += bitDurationRem;
+    if (rxPhaseRem >= baudRate) {
+        rxPhaseRem -= baudRate;
+        step++;
+    }
+    return step;
+}
+
+static void IRAM_ATTR deliver_frame(BaseType_t *woken)
+{
+    rxFrame.time_us = esp_timer_get_time();
+    if (xQueueSendFromISR(rxQueue, &rxFrame, woken) != pdTRUE) rxQueueFull++;
+    rxState = RX_HUNT;
+}
+
+// Link-layer framer, fed one byte at a time by the sample ISR. Only frames
+// the bytes; CRCs are checked by the main loop.
+static void IRAM_ATTR link_feed_byte(uint8_t byte, BaseType_t *woken)
+{
+    switch (rxState) {
+    case RX_HUNT:
+        if (byte == SYNC1) rxState = RX_TYPE;
+        break;
+    case RX_TYPE:
+        rxFrame.type = byte;
+        rxIndex = 0;
+        if (byte == SYNC2) { // legacy beacon: fixed length, no CRC
+            rxFrame.len = 6;
+            rxState = RX_PAYLOAD;
+        } else if (byte == SHORT_BEACON) { // fixed length, parity instead of CRC
+            rxFrame.len = 1;
+            rxState = RX_PAYLOAD;
+        } else if (is_typed_frame(byte)) {
+            rxState = RX_LEN;
+        } else {
+            rxState = (byte == SYNC1) ? RX_TYPE : RX_HUNT;
+        }
+        break;
+    case RX_LEN:
+        if (byte > FRAME_PAYLOAD_MAX) {
+            rxState = RX_HUNT;
+        } else {
+            rxFrame.len = byte;
+            rxState = byte ? RX_PAYLOAD : RX_CRC;
+        }
+        break;
+    case RX_PAYLOAD:
+        rxFrame.payload[rxIndex++] = byte;
+        if (rxIndex == rxFrame.len) {
+            if (rxFrame.type == SYNC2 || rxFrame.type == SHORT_BEACON) deliver_frame(woken);
+            else rxState = RX_CRC;
+        }
+        break;
+    case RX_CRC:
+        rxFrame.crc = byte;
+        deliver_frame(woken);
+        break;
+    }
+}
+
+static inline void IRAM_ATTR set_sample_period(uint32_t ticks)
+{
+    samplePeriod = ticks;
+    gptimer_alarm_config_t alarm_config = {
+        .alarm_count = ticks,
+        .reload_count = 0,
+        .flags = { .auto_reload_on_alarm = true }
+    };
+    gptimer_set_alarm_action(rx_timer, &alarm_config);
+}
+
+static void IRAM_ATTR arm_byte(int64_t now)
+{
+    receiving = true;
+    rxBitIndex = 0;
+    rxByte = 0;
+    armEdgeUs = now;
+    rxPhaseRem = 0;
+
+    // First sample 1.5 bits after the start edge lands mid data bit 0
+    set_sample_period(bitDurationUs + bitDurationUs / 2);
+    gptimer_set_raw_count(rx_timer, 0);
+    gptimer_start(rx_timer);
+}
+
+static void IRAM_ATTR disarm_byte()
+{
+    if (receiving) gptimer_stop(rx_timer);
+    receiving = false;
+    rxBitIndex = -1;
+    rxByte = 0;
+}
+
+// Edge ISR: start-bit detection and clock recovery. Our own transmission
+// reflects straight back into the demodulator, so the line is ignored
+// while we are sending.
+static void IRAM_ATTR on_rx_edge(void*)
+{
+    int64_t now = esp_timer_get_time();
+    bool level = gpio_get_level(IR_RX_GPIO);
+
+    if (now - lastEdgeUs > (int64_t)FRAME_GAP_BITS * bitDurationUs) {
+        rxState = RX_HUNT; // sender went quiet mid-frame
+    }
+    lastEdgeUs = now;
+
+    if (transmitting) {
+        disarm_byte();
+        rxState = RX_HUNT;
+        return;
+    }
+
+    if (!receiving) {
+        if (!level) arm_byte(now);
+    }
+    else if (rxBitIndex == 0 && level && now - armEdgeUs < bitDurationUs / 2) {
+        disarm_byte(); // start bit shorter than half a bit: glitch
+    }
+    else {
+        gptimer_set_raw_count(rx_timer, samplePeriod - bitDurationUs / 2);
+        rxPhaseRem = 0;
+    }
+}
+
+static bool IRAM_ATTR on_rx_timer(gptimer_handle_t timer, const gptimer_alarm_event_data_t*, void*)
+{
+    bool level = gpio_get_level(IR_RX_GPIO);
+    BaseType_t woken = pdFALSE;
+
+    // The counter reloads to 0 at the alarm, so its value now is our entry latency
+    uint64_t late = 0;
+    gptimer_get_raw_count(timer, &late);
+    portENTER_CRITICAL_ISR(&sampleLateMux);
+    if (late > sampleLateMax) sampleLateMax = late;
+    sampleLateSum += late;
+    sampleLateCount++;
+    portEXIT_CRITICAL_ISR(&sampleLateMux);
+
+    if (!receiving) {
+        gptimer_stop(timer);
+        return false;
+    }
+
+    set_sample_period(next_rx_step());
+
+    if (rxBitIndex >= 0 && rxBitIndex < 8) {
+        rxByte |= (level ? 1 : 0) << rxBitIndex;
+    }
+
+    rxBitIndex++;
+
+    if (rxBitIndex > 8) { // stop bit
+        uint8_t byte = rxByte;
+        disarm_byte();
+        if (level) link_feed_byte(byte, &woken);
+        else rxState = RX_HUNT; // framing error
+    }
+    return woken == pdTRUE;
+}
+
+// No byte and no frame in progress, and the line has been quiet for a
+// frame gap, so whatever was on the air has finished
+static bool rx_line_quiet(int64_t now)
+{
+    return !receiving && rxState == RX_HUNT &&
+           now - lastEdgeUs > (int64_t)FRAME_GAP_BITS * bitDurationUs;
+}
+
+// ======================================================================
+// UI pipe
+// ======================================================================
+
+// The link and log tasks never touch the display or the UART; each formats
+// lines into its own ring the UI task drains. Each ring has one producer and
+// one consumer, so head/tail stores are the only synchronisation needed.
+enum { UI_SERIAL = 1, UI_LCD = 2, UI_CLEAR = 4 };
+enum { CMD_BEACON, CMD_ARQ, CMD_PING, CMD_RECONFIG };
+
+typedef struct {
+    uint8_t dest;
+    char text[UI_MSG_LEN];
+} ui_msg_t;
+
+typedef struct {
+    ui_msg_t *ring;
+    uint32_t len; // power of two
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint32_t dropped;
+} ui_pipe_t;
+
+static ui_msg_t uiRing[UI_RING_LEN];
+static ui_msg_t logUiRing[LOG_UI_RING_LEN];
+static ui_pipe_t uiPipe = { uiRing, UI_RING_LEN, 0, 0, 0 };          // link task -> UI
+static ui_pipe_t logUiPipe = { logUiRing, LOG_UI_RING_LEN, 0, 0, 0 }; // log task -> UI
+
+static uint8_t cmdRing[CMD_RING_LEN];
+static volatile uint32_t cmdHead = 0;
+static volatile uint32_t cmdTail = 0;
+
+// The pipe's producer only. Lines are dropped, not waited for, when the UI
+// falls behind.
+static void ui_vpost(ui_pipe_t *pipe, uint8_t dest, const char *fmt, va_list args)
+{
+    uint32_t head = pipe->head;
+    if (head - __atomic_load_n(&pipe->tail, __ATOMIC_ACQUIRE) >= pipe->len) {
+        pipe->dropped++;
+        return;
+    }
+    ui_msg_t *msg = &pipe->ring[head % pipe->len];
+    msg->dest = dest;
+    vsnprintf(msg->text, sizeof(msg->text), fmt, args);
+    __atomic_store_n(&pipe->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Link task only
+static void ui_post(uint8_t dest, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    ui_vpost(&uiPipe, dest, fmt, args);
+    va_end(args);
+}
+
+// Log task only; serial only
+static void log_post(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    ui_vpost(&logUiPipe, UI_SERIAL, fmt, args);
+    va_end(args);
+}
+
+// UI task only
+static bool ui_next(ui_pipe_t *pipe, ui_msg_t *out)
+{
+    uint32_t tail = pipe->tail;
+    if (tail == __atomic_load_n(&pipe->head, __ATOMIC_ACQUIRE)) return false;
+    *out = pipe->ring[tail % pipe->len];
+    __atomic_store_n(&pipe->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static inline bool ui_pipe_empty(ui_pipe_t *pipe)
+{
+    return pipe->head == __atomic_load_n(&pipe->tail, __ATOMIC_ACQUIRE);
+}
+
+// UI task only
+static void cmd_post(uint8_t cmd)
+{
+    uint32_t head = cmdHead;
+    if (head - __atomic_load_n(&cmdTail, __ATOMIC_ACQUIRE) >= CMD_RING_LEN) return;
+    cmdRing[head % CMD_RING_LEN] = cmd;
+    __atomic_store_n(&cmdHead, head + 1, __ATOMIC_RELEASE);
+}
+
+// Link task only
+static bool cmd_next(uint8_t *cmd)
+{
+    uint32_t tail = cmdTail;
+    if (tail == __atomic_load_n(&cmdHead, __ATOMIC_ACQUIRE)) return false;
+    *cmd = cmdRing[tail % CMD_RING_LEN];
+    __atomic_store_n(&cmdTail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Light sleep stops both cores, so ui_task and log_task must not be halfway
+// through a display transfer or a flash write. The link task asks each to
+// park at a safe point and sleeps only once both have.
+enum { PARK_RUN, PARK_REQ, PARKED, PARK_GONE };
+
+typedef struct {
+    volatile uint8_t state;
+    TaskHandle_t task;
+} park_t;
+
+static park_t uiPark = { PARK_RUN, NULL };
+static park_t logPark = { PARK_RUN, NULL };
+
+// Link task only. True once the task is parked, or has exited.
+static bool task_park(park_t *p)
+{
+    uint8_t state = PARK_RUN;
+    __atomic_compare_exchange_n(&p->state, &state, PARK_REQ, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    return state == PARKED || state == PARK_GONE;
+}
+
+// Link task only
+static void task_unpark(park_t *p)
+{
+    uint8_t state = __atomic_load_n(&p->state, __ATOMIC_ACQUIRE);
+    while ((state == PARK_REQ || state == PARKED) &&
+           !__atomic_compare_exchange_n(&p->state, &state, PARK_RUN, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    }
+    if (state == PARKED) xTaskNotifyGive(p->task);
+}
+
+// Parked task only, at a safe point
+static void park_point(park_t *p)
+{
+    uint8_t state = PARK_REQ;
+    if (!__atomic_compare_exchange_n(&p->state, &state, PARKED, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return;
+    while (__atomic_load_n(&p->state, __ATOMIC_ACQUIRE) == PARKED) ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+}
+
+// ======================================================================
+// Sightings log
+// ======================================================================
+
+typedef struct {
+    uint32_t seq;
+    uint32_t time_ms; // uptime when heard; seq keeps order across reboots
+    uint8_t mac[6];
+    uint8_t hops;     // 0: heard directly
+    uint8_t crc;      // crc8 over the 15 bytes before it
+} log_rec_t;
+static_assert(sizeof(log_rec_t) == LOG_REC_SIZE, "log record layout");
+
+static log_rec_t logRing[LOG_RING_LEN];
+static volatile uint32_t logHead = 0;
+static volatile uint32_t logTail = 0;
+static volatile bool logReady = false;
+static uint32_t logDropped = 0; // ring full: the log task is behind
+
+static const esp_partition_t *logPart = NULL;
+static uint32_t logSlots = 0;   // records the partition holds
+static uint32_t logNext = 0;    // slot the next record goes to
+static uint32_t logRoom = 0;    // erased slots from logNext on
+static volatile bool linkQuiet = false; // link task's view, for erasing ahead
+static uint32_t logSeq = 0;
+
+static uint32_t logRecords = 0;
+static uint32_t logWrites = 0;
+static uint64_t logProgrammed = 0; // bytes
+static uint32_t logErases = 0;
+static int64_t logBusyUs = 0;      // time spent in flash calls
+static int64_t logWorstUs = 0;
+
+// Link task only. Never blocks: a sighting is dropped if the log task is behind.
+static void log_sighting(const uint8_t *mac, uint8_t hops, int64_t now)
+{
+    if (!logReady) return;
+    uint32_t head = logHead;
+    if (head - __atomic_load_n(&logTail, __ATOMIC_ACQUIRE) >= LOG_RING_LEN) {
+        logDropped++;
+        return;
+    }
+    log_rec_t *rec = &logRing[head % LOG_RING_LEN];
+    rec->time_ms = (uint32_t)(now / 1000);
+    memcpy(rec->mac, mac, 6);
+    rec->hops = hops;
+    __atomic_store_n(&logHead, head + 1, __ATOMIC_RELEASE);
+}
+
+static inline bool log_rec_valid(const log_rec_t *rec)
+{
+    return rec->crc == crc8(0, (const uint8_t *)rec, LOG_REC_SIZE - 1);
+}
+
+static inline bool log_rec_blank(const log_rec_t *rec)
+{
+    const uint8_t *b = (const uint8_t *)rec;
+    for (int i = 0; i < LOG_REC_SIZE; i++) {
+        if (b[i] != 0xFF) return false;
+    }
+    return true;
+}
+
+static void log_read(uint32_t slot, log_rec_t *rec)
+{
+    esp_partition_read(logPart, (size_t)slot * LOG_REC_SIZE, rec, LOG_REC_SIZE);
+}
+
+// Find where the previous boot stopped without reading the whole log: the
+// first record of each sector gives the newest sector, and slots fill in
+// order, so a binary search inside it finds the first blank one.
+static void log_rebuild_index()
+{
+    int64_t start = esp_timer_get_time();
+    uint32_t sectors = logSlots / LOG_RECS_PER_SECTOR;
+    uint32_t reads = 0;
+    int32_t newest = -1;
+    uint32_t newestSeq = 0;
+
+    for (uint32_t s = 0; s < sectors; s++) {
+        log_rec_t rec;
+        log_read(s * LOG_RECS_PER_SECTOR, &rec);
+        reads++;
+        if (log_rec_blank(&rec) || !log_rec_valid(&rec)) continue;
+        if (newest < 0 || (int32_t)(rec.seq - newestSeq) > 0) {
+            newest = s;
+            newestSeq = rec.seq;
+        }
+    }
+
+    if (newest < 0) {
+        logNext = 0;
+        logSeq = 0;
+    } else {
+        uint32_t base = newest * LOG_RECS_PER_SECTOR;
+        uint32_t lo = 1, hi = LOG_RECS_PER_SECTOR; // slot 0 is known to be used
+        while (lo < hi) {
+            uint32_t mid = (lo + hi) / 2;
+            log_rec_t rec;
+            log_read(base + mid, &rec);
+            reads++;
+            if (log_rec_blank(&rec)) hi = mid;
+            else lo = mid + 1;
+        }
+        log_rec_t last;
+        log_read(base + lo - 1, &last);
+        reads++;
+        // A torn last record still consumes its slot; number on from its sector start
+        logSeq = log_rec_valid(&last) ? last.seq + 1 : newestSeq + lo;
+        logNext = (base + lo) % logSlots;
+        logRoom = logNext % LOG_RECS_PER_SECTOR ? LOG_RECS_PER_SECTOR - logNext % LOG_RECS_PER_SECTOR : 0;
+    }
+
+    log_post("Sightings log: %lu records capacity, next slot %lu, seq %lu; index rebuilt in %lld us (%lu reads)\n",
+             (unsigned long)logSlots, (unsigned long)logNext, (unsigned long)logSeq,
+             (long long)(esp_timer_get_time() - start), (unsigned long)reads);
+}
+
+static void log_show_recent(int count)
+{
+    for (int i = 1; i <= count && (uint32_t)i <= logSeq; i++) {
+        log_rec_t rec;
+        log_read((logNext + logSlots - i) % logSlots, &rec);
+        if (!log_rec_valid(&rec)) break;
+        const uint8_t *m = rec.mac;
+        log_post("  #%lu %02X:%02X:%02X:%02X:%02X:%02X at %lu.%03lu s, %u hop(s)\n",
+                 (unsigned long)rec.seq, m[0], m[1], m[2], m[3], m[4], m[5],
+                 (unsigned long)(rec.time_ms / 1000), (unsigned long)(rec.time_ms % 1000), rec.hops);
+    }
+}
+
+// Write up to 'count' records to the erased slots from logNext on; returns
+// how many fitted. Never erases. Records never straddle a sector, so one
+// call is at most two writes.
+static uint32_t log_flush(const log_rec_t *recs, uint32_t count)
+{
+    uint32_t done = 0;
+    while (done < count && logRoom) {
+        uint32_t room = LOG_RECS_PER_SECTOR - logNext % LOG_RECS_PER_SECTOR;
+        if (room > logRoom) room = logRoom;
+        uint32_t n = count - done < room ? count - done : room;
+
+        int64_t start = esp_timer_get_time();
+        esp_partition_write(logPart, (size_t)logNext * LOG_REC_SIZE, &recs[done], n * LOG_REC_SIZE);
+        int64_t took = esp_timer_get_time() - start;
+
+        logBusyUs += took;
+        if (took > logWorstUs) logWorstUs = took;
+        logWrites++;
+        logProgrammed += n * LOG_REC_SIZE;
+        logRecords += n;
+        logNext = (logNext + n) % logSlots;
+        logRoom -= n;
+        done += n;
+    }
+    return done;
+}
+
+// Keep one whole sector erased beyond the one being filled. An erase holds
+// the flash cache on both cores for 45-400 ms, so it is only started while
+// the link is quiet; until then sightings wait in the ring, or are dropped.
+static void log_erase_ahead()
+{
+    if (logRoom > LOG_RECS_PER_SECTOR || !__atomic_load_n(&linkQuiet, __ATOMIC_ACQUIRE)) return;
+
+    uint32_t slot = (logNext + logRoom) % logSlots;
+    int64_t start = esp_timer_get_time();
+    esp_partition_erase_range(logPart, (size_t)slot * LOG_REC_SIZE, LOG_SECTOR);
+    int64_t took = esp_timer_get_time() - start;
+
+    logBusyUs += took;
+    if (took > logWorstUs) logWorstUs = took;
+    logErases++;
+    logRoom += LOG_RECS_PER_SECTOR;
+}
+
+static void log_report(int64_t spanUs)
+{
+    uint64_t logical = (uint64_t)logRecords * LOG_REC_SIZE;
+    uint64_t physical = logProgrammed + (uint64_t)logErases * LOG_SECTOR;
+    log_post("Sightings log: %lu records in %lu writes, %lu erases, %lu dropped; write amplification %lu.%02lu "
+             "(programmed + erased / logged)\n",
+             (unsigned long)logRecords, (unsigned long)logWrites, (unsigned long)logErases, (unsigned long)logDropped,
+             (unsigned long)(logical ? physical / logical : 0), (unsigned long)(logical ? physical * 100 / logical % 100 : 0));
+    log_post("Sightings log: flash busy %lld ms (%lu.%lu%%), worst call %lld ms, "
+             "sustainable ~%lu records/s; %lu frames lost to a full RX queue\n",
+             (long long)(logBusyUs / 1000),
+             (unsigned long)(spanUs ? logBusyUs * 100 / spanUs : 0), (unsigned long)(spanUs ? logBusyUs * 1000 / spanUs % 10 : 0),
+             (long long)(logWorstUs / 1000),
+             (unsigned long)(logBusyUs ? (int64_t)logRecords * 1000000 / logBusyUs : 0),
+             (unsigned long)rxQueueFull);
+}
+
+// Background writer on the UI core. Batches sightings into page-sized writes
+// so flash calls, which stall the cache on both cores, are few and short;
+// the long ones, sector erases, wait for a quiet link.
+static void log_task(void*)
+{
+    logPart = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, LOG_PARTITION);
+    if (!logPart || logPart->size < 2 * LOG_SECTOR) { // one sector filling, one erased ahead
+        log_post("Sightings log: no \"%s\" partition of 8 KB or more, logging disabled\n", LOG_PARTITION);
+        __atomic_store_n(&logPark.state, PARK_GONE, __ATOMIC_RELEASE);
+        vTaskDelete(NULL);
+        return;
+    }
+    logSlots = logPart->size / LOG_SECTOR * LOG_RECS_PER_SECTOR;
+    log_rebuild_index();
+    log_show_recent(LOG_SHOW_AT_BOOT);
+    logReady = true;
+
+    static log_rec_t batch[LOG_BATCH];
+    uint32_t batched = 0;
+    int64_t batchStart = 0;
+    int64_t since = esp_timer_get_time();
+    int64_t nextReport = since + JITTER_REPORT_US;
+
+    while (1) {
+        int64_t now = esp_timer_get_time();
+        uint32_t tail = logTail;
+        while (batched < LOG_BATCH && tail != __atomic_load_n(&logHead, __ATOMIC_ACQUIRE)) {
+            log_rec_t *rec = &batch[batched];
+            *rec = logRing[tail % LOG_RING_LEN];
+            __atomic_store_n(&logTail, ++tail, __ATOMIC_RELEASE);
+            rec->seq = logSeq++;
+            rec->crc = crc8(0, (const uint8_t *)rec, LOG_REC_SIZE - 1);
+            if (batched++ == 0) batchStart = now;
+        }
+
+        log_erase_ahead();
+        if (batched == LOG_BATCH || (batched && now - batchStart >= LOG_FLUSH_US)) {
+            uint32_t n = log_flush(batch, batched);
+            memmove(batch, &batch[n], (batched - n) * sizeof(batch[0]));
+            batched -= n;
+        }
+        if (now >= nextReport && logRecords) {
+            log_report(now - since);
+            nextReport = now + JITTER_REPORT_US;
+        }
+        vTaskDelay(pdMS_TO_TICKS(50));
+#if LOW_POWER_MODE
+        park_point(&logPark);
+#endif
+    }
+}
+
+// ======================================================================
+// ARQ transport
+// ======================================================================
+
+typedef struct {
+    bool active;
+    uint8_t xfer;
+    uint8_t nfrags;
+    uint8_t base;       // oldest unacknowledged fragment
+    uint8_t next;       // first fragment never sent
+    uint8_t sinceSlot;  // fragments queued since the last ACK slot
+    uint8_t retries;
+    bool inSlot;
+    int64_t slotEnd;    // 0 until our last fragment has left
+    int64_t startUs;
+    uint32_t fragsSent; // including retransmissions
+    size_t len;
+    bool acked[ARQ_MAX_FRAGS];
+    bool resend[ARQ_MAX_FRAGS];
+    uint8_t data[ARQ_MAX_BYTES];
+} arq_tx_t;
+
+typedef struct {
+    bool active;
+    bool complete;
+    bool ackPending;
+    uint8_t src[6];
+    uint8_t xfer;
+    uint8_t nfrags;
+    uint8_t fragsHeld;
+    int64_t startUs;
+    size_t len;
+    bool have[ARQ_MAX_FRAGS];
+    uint8_t data[ARQ_MAX_BYTES];
+} arq_rx_t;
+
+static arq_tx_t arqTx;
+static arq_rx_t arqRx;
+static uint8_t nextXfer = 0;
+
+static void print_goodput(const char *who, size_t bytes, int64_t elapsedUs, uint32_t frames)
+{
+    uint32_t goodput = elapsedUs > 0 ? (uint32_t)((int64_t)bytes * 8 * 1000000 / elapsedUs) : 0;
+    ui_post(UI_SERIAL, "%s: %u bytes in %lld ms, %lu frames, goodput %lu bit/s = %lu%% of %lu baud\n",
+            who, (unsigned)bytes, (long long)(elapsedUs / 1000), (unsigned long)frames,
+            (unsigned long)goodput, (unsigned long)(goodput * 100 / baudRate), (unsigned long)baudRate);
+    ui_post(UI_LCD, "%s %lu bit/s (%lu%%)\n", who,
+            (unsigned long)goodput, (unsigned long)(goodput * 100 / baudRate));
+}
+
+// Start sending a blob. Returns false if a transfer is already running.
+bool arq_send(const uint8_t *data, size_t len)
+{
+    if (arqTx.active || len == 0 || len > ARQ_MAX_BYTES) return false;
+
+    memcpy(arqTx.data, data, len);
+    arqTx.len = len;
+    arqTx.nfrags = (len + ARQ_FRAG_SIZE - 1) / ARQ_FRAG_SIZE;
+    arqTx.xfer = nextXfer++;
+    arqTx.base = 0;
+    arqTx.next = 0;
+    arqTx.sinceSlot = 0;
+    arqTx.retries = 0;
+    arqTx.inSlot = false;
+    arqTx.fragsSent = 0;
+    arqTx.startUs = esp_timer_get_time();
+    memset(arqTx.acked, 0, sizeof(arqTx.acked));
+    memset(arqTx.resend, 0, sizeof(arqTx.resend));
+    arqTx.active = true;
+    return true;
+}
+
+static bool arq_send_fragment(uint8_t seq)
+{
+    size_t off = (size_t)seq * ARQ_FRAG_SIZE;
+    size_t n = arqTx.len - off < ARQ_FRAG_SIZE ? arqTx.len - off : ARQ_FRAG_SIZE;
+
+    uint8_t payload[ARQ_DATA_HDR + ARQ_FRAG_SIZE];
+    memcpy(payload, mac_self, 6);
+    payload[6] = arqTx.xfer;
+    payload[7] = seq;
+    payload[8] = arqTx.nfrags;
+    memcpy(&payload[ARQ_DATA_HDR], &arqTx.data[off], n);
+    if (send_typed(FRAME_DATA, payload, ARQ_DATA_HDR + n) < 0) return false;
+    arqTx.fragsSent++;
+    return true;
+}
+
+// Lost fragments first, then new ones while the window has room; -1 if none
+static int arq_next_fragment()
+{
+    for (uint8_t seq = arqTx.base; seq < arqTx.next; seq++)
+        if (arqTx.resend[seq]) return seq;
+    if (arqTx.next < arqTx.nfrags && arqTx.next < arqTx.base + ARQ_WINDOW) return arqTx.next;
+    return -1;
+}
+
+// Sender side: keep up to ARQ_WINDOW fragments in flight. After every
+// ARQ_ACK_EVERY fragments the line is left quiet for one ACK, and each ACK
+// slides the window on straight away; the next fragments go out without
+// waiting for the rest of the window to be acknowledged.
+static void arq_tx_poll(int64_t now)
+{
+    if (!arqTx.active) return;
+
+    if (arqTx.inSlot) {
+        if (transmitting || !tx_queue_empty()) return;
+        if (arqTx.slotEnd == 0) {
+            arqTx.slotEnd = now + ARQ_ACK_IDLE_US
+                          + frame_airtime_us(FRAME_OVERHEAD + ARQ_ACK_LEN) + ARQ_ACK_WAIT_US;
+            return;
+        }
+        if (now < arqTx.slotEnd) return;
+        arqTx.inSlot = false;
+
+        // No ACK. Carry on if the window still has room, else resend it.
+        if (arq_next_fragment() < 0) {
+            if (++arqTx.retries > ARQ_MAX_RETRIES) {
+                ui_post(UI_SERIAL, "ARQ TX: transfer %u abandoned\n", arqTx.xfer);
+                ui_post(UI_LCD, "ARQ TX failed\n");
+                arqTx.active = false;
+                return;
+            }
+            for (uint8_t seq = arqTx.base; seq < arqTx.next; seq++)
+                arqTx.resend[seq] = !arqTx.acked[seq];
+        }
+    }
+
+    int seq;
+    while (arqTx.sinceSlot < ARQ_ACK_EVERY && (seq = arq_next_fragment()) >= 0) {
+        if (!arq_send_fragment(seq)) return; // TX queue full, next poll
+        if (seq == arqTx.next) arqTx.next++;
+        arqTx.resend[seq] = false;
+        arqTx.sinceSlot++;
+    }
+
+    // With nothing to send the slot doubles as the retransmit timeout
+    arqTx.inSlot = true;
+    arqTx.slotEnd = 0;
+    arqTx.sinceSlot = 0;
+}
+
+static void arq_handle_ack(const uint8_t *p, size_t len)
+{
+    if (len != ARQ_ACK_LEN || !arqTx.active) return;
+    if (memcmp(p, mac_self, 6) != 0 || p[6] != arqTx.xfer) return;
+
+    uint8_t cum = p[7];
+    uint32_t sack = p[8] | (p[9] << 8) | (p[10] << 16) | ((uint32_t)p[11] << 24);
+    for (uint8_t seq = 0; seq < cum && seq < arqTx.nfrags; seq++) arqTx.acked[seq] = true;
+    for (int i = 0; i < 32; i++) {
+        int seq = cum + 1 + i;
+        if (seq < arqTx.nfrags && (sack & (1u << i))) arqTx.acked[seq] = true;
+    }
+
+    // ACKs are only sent in our quiet slots, so every gap below the highest
+    // fragment received is a loss, not a fragment still on its way.
+    int top = -1;
+    for (int seq = arqTx.next - 1; seq >= arqTx.base; seq--)
+        if (arqTx.acked[seq]) { top = seq; break; }
+    for (int seq = arqTx.base; seq < top; seq++)
+        if (!arqTx.acked[seq]) arqTx.resend[seq] = true;
+
+    uint8_t oldBase = arqTx.base;
+    while (arqTx.base < arqTx.nfrags && arqTx.acked[arqTx.base]) arqTx.base++;
+    if (arqTx.base != oldBase) arqTx.retries = 0;
+    if (arq_next_fragment() >= 0) arqTx.inSlot = false; // send on straight away
+
+    if (arqTx.base == arqTx.nfrags) {
+        print_goodput("ARQ TX", arqTx.len, esp_timer_get_time() - arqTx.startUs, arqTx.fragsSent);
+        arqTx.active = false;
+    }
+}
+
+static void arq_handle_data(const uint8_t *p, size_t len, int64_t now)
+{
+    if (len < ARQ_DATA_HDR + 1 || len > ARQ_DATA_HDR + ARQ_FRAG_SIZE) return;
+
+    const uint8_t *src = p;
+    uint8_t xfer = p[6], seq = p[7], nfrags = p[8];
+    if (nfrags == 0 || nfrags > ARQ_MAX_FRAGS || seq >= nfrags) return;
+    if (memcmp(src, mac_self, 6) == 0) return;
+
+    if (!arqRx.active || memcmp(src, arqRx.src, 6) != 0 || xfer != arqRx.xfer) {
+        memcpy(arqRx.src, src, 6);
+        arqRx.xfer = xfer;
+        arqRx.nfrags = nfrags;
+        arqRx.fragsHeld = 0;
+        arqRx.len = 0;
+        arqRx.complete = false;
+        arqRx.startUs = now;
+        memset(arqRx.have, 0, sizeof(arqRx.have));
+        arqRx.active = true;
+    }
+
+    size_t n = len - ARQ_DATA_HDR;
+    if (!arqRx.have[seq]) {
+        memcpy(&arqRx.data[(size_t)seq * ARQ_FRAG_SIZE], &p[ARQ_DATA_HDR], n);
+        arqRx.have[seq] = true;
+        arqRx.fragsHeld++;
+        if (seq == nfrags - 1) arqRx.len = (size_t)seq * ARQ_FRAG_SIZE + n;
+    }
+    arqRx.ackPending = true;
+
+    if (!arqRx.complete && arqRx.fragsHeld == arqRx.nfrags) {
+        arqRx.complete = true;
+        print_goodput("ARQ RX", arqRx.len, now - arqRx.startUs, arqRx.nfrags);
+    }
+}
+
+// Receiver side: acknowledge in the sender's quiet slot (line idle)
+static void arq_rx_poll(int64_t now)
+{
+    if (!arqRx.ackPending || transmitting) return;
+    if (now - lastEdgeUs < ARQ_ACK_IDLE_US) return;
+
+    uint8_t cum = 0;
+    while (cum < arqRx.nfrags && arqRx.have[cum]) cum++;
+    uint32_t sack = 0;
+    for (int i = 0; i < 32; i++) {
+        int seq = cum + 1 + i;
+        if (seq < arqRx.nfrags && arqRx.have[seq]) sack |= 1u << i;
+    }
+
+    uint8_t payload[ARQ_ACK_LEN];
+    memcpy(payload, arqRx.src, 6);
+    payload[6] = arqRx.xfer;
+    payload[7] = cum;
+    payload[8] = sack & 0xFF;
+    payload[9] = (sack >> 8) & 0xFF;
+    payload[10] = (sack >> 16) & 0xFF;
+    payload[11] = (sack >> 24) & 0xFF;
+    if (send_typed(FRAME_ACK, payload, sizeof(payload)) >= 0) arqRx.ackPending = false;
+}
+
+// ======================================================================
+// Ping / echo
+// ======================================================================
+
+typedef struct {
+    bool active;
+    uint16_t nextSeq;
+    uint16_t maxSeqSeen;
+    int64_t lastPingUs;
+    uint32_t sent;
+    uint32_t received;
+    uint32_t reordered;
+    uint32_t duplicates;
+    uint32_t rttCount;              // total samples, ring index = rttCount % PING_SAMPLES
+    uint32_t rttUs[PING_SAMPLES];
+    bool seen[256];                 // by seq % 256, cleared when that seq is sent
+} ping_stats_t;
+
+static ping_stats_t ping;
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void ping_report(int64_t now)
+{
+    static uint32_t sorted[PING_SAMPLES];
+    uint32_t n = ping.rttCount < PING_SAMPLES ? ping.rttCount : PING_SAMPLES;
+    memcpy(sorted, ping.rttUs, n * sizeof(uint32_t));
+    qsort(sorted, n, sizeof(uint32_t), cmp_u32);
+
+    // Unanswered pings younger than the timeout are still in flight, not lost
+    uint32_t due = ping.sent;
+    for (uint32_t age = 0; age < ping.sent && age < 256; age++) {
+        if (now - ping.lastPingUs + (int64_t)age * PING_INTERVAL_US >= PING_TIMEOUT_US) break;
+        if (!ping.seen[(uint16_t)(ping.nextSeq - 1 - age) % 256]) due--;
+    }
+    uint32_t lost = due > ping.received ? due - ping.received : 0;
+    uint32_t lossPermille = due ? lost * 1000 / due : 0;
+
+    uint32_t p50 = n ? sorted[n / 2] : 0;
+    uint32_t p90 = n ? sorted[n * 9 / 10] : 0;
+    uint32_t p99 = n ? sorted[n * 99 / 100] : 0;
+    uint32_t max = n ? sorted[n - 1] : 0;
+
+    ui_post(UI_SERIAL, "Ping: %lu sent, %lu echoed, loss %lu.%lu%%, %lu reordered, %lu dup | "
+            "RTT p50 %lu p90 %lu p99 %lu max %lu us (one-way airtime %lld us)\n",
+            (unsigned long)ping.sent, (unsigned long)ping.received,
+            (unsigned long)(lossPermille / 10), (unsigned long)(lossPermille % 10),
+            (unsigned long)ping.reordered, (unsigned long)ping.duplicates,
+            (unsigned long)p50, (unsigned long)p90, (unsigned long)p99, (unsigned long)max,
+            (long long)frame_airtime_us(FRAME_OVERHEAD + PING_LEN));
+
+    ui_post(UI_CLEAR | UI_LCD, "Ping\n");
+    ui_post(UI_LCD, "tx %lu rx %lu\n", (unsigned long)ping.sent, (unsigned long)ping.received);
+    ui_post(UI_LCD, "loss %lu.%lu%% ro %lu\n", (unsigned long)(lossPermille / 10),
+            (unsigned long)(lossPermille % 10), (unsigned long)ping.reordered);
+    ui_post(UI_LCD, "p50 %lu ms\n", (unsigned long)(p50 / 1000));
+    ui_post(UI_LCD, "p90 %lu ms\n", (unsigned long)(p90 / 1000));
+    ui_post(UI_LCD, "p99 %lu ms\n", (unsigned long)(p99 / 1000));
+}
+
+static void ping_start()
+{
+    memset(&ping, 0, sizeof(ping));
+    ping.active = true;
+}
+
+static void ping_poll(int64_t now)
+{
+    if (!ping.active || now - ping.lastPingUs < PING_INTERVAL_US) return;
+
+    uint16_t seq = ping.nextSeq;
+    uint32_t ts = (uint32_t)now;
+    uint8_t payload[PING_LEN];
+    memcpy(payload, mac_self, 6);
+    payload[6] = seq & 0xFF;
+    payload[7] = seq >> 8;
+    memcpy(&payload[8], &ts, 4);
+    if (send_typed(FRAME_PING, payload, sizeof(payload)) < 0) return; // queue busy, retry next loop
+
+    ping.seen[seq % 256] = false;
+    ping.nextSeq++;
+    ping.sent++;
+    ping.lastPingUs = now;
+
+    if (ping.sent % PING_REPORT_EVERY == 0) ping_report(now);
+}
+
+// Peer side: bounce the request straight back, payload untouched
+static void ping_handle_request(const uint8_t *p, size_t len)
+{
+    if (len != PING_LEN || memcmp(p, mac_self, 6) == 0) return;
+    send_typed(FRAME_ECHO, p, len);
+}
+
+static void ping_handle_echo(const uint8_t *p, size_t len, int64_t rxUs)
+{
+    if (len != PING_LEN || !ping.active || memcmp(p, mac_self, 6) != 0) return;
+
+    uint16_t seq = p[6] | (p[7] << 8);
+    uint32_t ts;
+    memcpy(&ts, &p[8], 4);
+    uint32_t rtt = (uint32_t)rxUs - ts;
+    if (rtt > PING_TIMEOUT_US) return; // too late, already counted as lost
+
+    if (ping.seen[seq % 256]) {
+        ping.duplicates++;
+        return;
+    }
+    ping.seen[seq % 256] = true;
+
+    if (ping.received && (int16_t)(seq - ping.maxSeqSeen) < 0) ping.reordered++;
+    else ping.maxSeqSeen = seq;
+
+    ping.received++;
+    ping.rttUs[ping.rttCount++ % PING_SAMPLES] = rtt;
+}
+
+// ======================================================================
+// Flooding relay
+// ======================================================================
+
+typedef struct {
+    uint8_t origin[6];
+    uint16_t seq;
+    int64_t seenUs; // 0: free slot
+} flood_seen_t;
+
+typedef struct {
+    uint8_t payload[FLOOD_LEN];
+    int64_t dueUs;
+    uint8_t copies; // duplicates overheard since it was scheduled
+    bool used;
+} flood_pending_t;
+
+static flood_seen_t floodCache[FLOOD_CACHE_SIZE];
+static flood_pending_t floodPending[FLOOD_PENDING];
+static uint16_t floodSeq = 0;
+
+static uint32_t floodOriginated = 0;
+static uint32_t floodReceived = 0;
+static uint32_t floodDuplicates = 0;
+static uint32_t floodRelayed = 0;
+static uint32_t floodSuppressed = 0;
+static uint32_t floodDropped = 0;   // pending table or TX queue full
+static int64_t relayAirtimeUs = 0;  // channel time spent forwarding others' beacons
+
+// Look up (origin, seq); if absent, remember it, evicting an expired or the
+// oldest entry. Returns true if it was already known.
+static bool flood_cache_check(const uint8_t *origin, uint16_t seq, int64_t now)
+{
+    flood_seen_t *victim = &floodCache[0];
+    for (int i = 0; i < FLOOD_CACHE_SIZE; i++) {
+        flood_seen_t *e = &floodCache[i];
+        if (e->seenUs && now - e->seenUs >= FLOOD_CACHE_US) e->seenUs = 0;
+        if (e->seenUs && e->seq == seq && memcmp(e->origin, origin, 6) == 0) return true;
+        if (e->seenUs < victim->seenUs) victim = e;
+    }
+    memcpy(victim->origin, origin, 6);
+    victim->seq = seq;
+    victim->seenUs = now;
+    return false;
+}
+
+static void flood_send_beacon(int64_t now)
+{
+    uint8_t payload[FLOOD_LEN];
+    memcpy(payload, mac_self, 6);
+    payload[6] = floodSeq & 0xFF;
+    payload[7] = floodSeq >> 8;
+    payload[8] = FLOOD_TTL;
+    payload[9] = 0;
+    if (send_typed(FRAME_FLOOD, payload, sizeof(payload)) < 0) return;
+
+    flood_cache_check(mac_self, floodSeq, now); // our own copy coming back is a duplicate
+    floodSeq++;
+    floodOriginated++;
+}
+
+static void flood_handle(const uint8_t *p, size_t len, int64_t now)
+{
+    if (len != FLOOD_LEN) return;
+    uint16_t seq = p[6] | (p[7] << 8);
+
+    if (flood_cache_check(p, seq, now)) {
+        floodDuplicates++;
+        for (int i = 0; i < FLOOD_PENDING; i++) {
+            flood_pending_t *r = &floodPending[i];
+            if (r->used && memcmp(r->payload, p, 8) == 0) r->copies++;
+        }
+        return;
+    }
+
+    floodReceived++;
+    log_sighting(p, p[9], now); // relays so far; 0 straight from the originator
+    const uint8_t *m = p;
+    ui_post(UI_SERIAL, "Received MAC: %02X:%02X:%02X:%02X:%02X:%02X seq %u, %u hop(s)\n",
+            m[0], m[1], m[2], m[3], m[4], m[5], seq, p[9] + 1);
+    ui_post(UI_LCD, "Recv MAC: %02X:%02X:%02X:%02X:%02X:%02X (%u)\n",
+            m[0], m[1], m[2], m[3], m[4], m[5], p[9] + 1);
+
+    if (p[8] <= 1) return; // TTL spent
+
+    for (int i = 0; i < FLOOD_PENDING; i++) {
+        flood_pending_t *r = &floodPending[i];
+        if (r->used) continue;
+        memcpy(r->payload, p, FLOOD_LEN);
+        r->payload[8]--;
+        r->payload[9]++;
+        r->dueUs = now + esp_random() % FLOOD_JITTER_US;
+        r->copies = 0;
+        r->used = true;
+        return;
+    }
+    floodDropped++;
+}
+
+// Send relays whose delay has run out, unless enough neighbours already
+// forwarded the same beacon. Waits for a quiet line so we do not talk over
+// a frame in progress.
+static void flood_poll(int64_t now)
+{
+    for (int i = 0; i < FLOOD_PENDING; i++) {
+        flood_pending_t *r = &floodPending[i];
+        if (!r->used || now < r->dueUs) continue;
+
+        if (r->copies >= FLOOD_SUPPRESS) {
+            floodSuppressed++;
+            r->used = false;
+            continue;
+        }
+        if (!rx_line_quiet(now)) continue;
+
+        if (send_typed(FRAME_FLOOD, r->payload, FLOOD_LEN) < 0) {
+            floodDropped++;
+        } else {
+            floodRelayed++;
+            relayAirtimeUs += frame_airtime_us(FLOOD_LEN + FRAME_OVERHEAD);
+        }
+        r->used = false;
+    }
+}
+
+static void flood_report(int64_t now)
+{
+    ui_post(UI_SERIAL, "Flood: %lu originated, %lu heard, %lu dup, %lu relayed, %lu suppressed, %lu dropped, "
+            "relay airtime %lld ms (%lu.%lu%% of uptime)\n",
+            (unsigned long)floodOriginated, (unsigned long)floodReceived,
+            (unsigned long)floodDuplicates, (unsigned long)floodRelayed,
+            (unsigned long)floodSuppressed, (unsigned long)floodDropped,
+            (long long)(relayAirtimeUs / 1000),
+            (unsigned long)(relayAirtimeUs * 100 / now), (unsigned long)(relayAirtimeUs * 1000 / now % 10));
+}
+
+// ======================================================================
+// Short addresses
+// ======================================================================
+
+// Peer table indexed directly by short address, so expanding a short
+// beacon back to a MAC is a single array access.
+typedef struct {
+    uint8_t mac[6];
+    int64_t lastSeenUs; // 0: slot free
+} peer_t;
+
+static peer_t peers[SHORT_ADDRS];
+static uint8_t shortSelf = 0;
+static bool shortAnnounced = false;
+static uint32_t shortBeaconsSent = 0;
+static uint32_t shortBeaconsHeard = 0;
+static uint32_t shortUnknown = 0; // short beacons from peers we have no announcement for
+static uint32_t shortCollisions = 0;
+
+static inline uint8_t short_hash(const uint8_t *mac)
+{
+    return crc8(0, mac, 6) % SHORT_ADDRS;
+}
+
+static inline uint8_t short_encode(uint8_t addr)
+{
+    return addr | (__builtin_parity(addr) << 7);
+}
+
+static inline bool peer_live(const peer_t *p, int64_t now)
+{
+    return p->lastSeenUs && now - p->lastSeenUs < PEER_EXPIRE_US;
+}
+
+// First address at or after the MAC's hash that no other live peer holds
+static uint8_t short_pick(int64_t now)
+{
+    uint8_t addr = short_hash(mac_self);
+    for (int i = 0; i < SHORT_ADDRS; i++) {
+        const peer_t *p = &peers[addr];
+        if (!peer_live(p, now) || memcmp(p->mac, mac_self, 6) == 0) return addr;
+        addr = (addr + 1) % SHORT_ADDRS;
+    }
+    return short_hash(mac_self); // table full; collide rather than go silent
+}
+
+static void short_announce(int64_t now)
+{
+    shortSelf = short_pick(now);
+    uint8_t payload[ANNOUNCE_LEN];
+    memcpy(payload, mac_self, 6);
+    payload[6] = shortSelf;
+    shortAnnounced = send_typed(FRAME_ANNOUNCE, payload, sizeof(payload)) >= 0;
+}
+
+static void short_send_beacon(int64_t now)
+{
+    if (!shortAnnounced || shortBeaconsSent % SHORT_ANNOUNCE_EVERY == 0) short_announce(now);
+
+    uint8_t frame[3] = { SYNC1, SHORT_BEACON, short_encode(shortSelf) };
+    if (send_frame(frame, sizeof(frame), NULL, NULL) >= 0) shortBeaconsSent++;
+}
+
+static void short_handle_announce(const uint8_t *p, size_t len, int64_t now)
+{
+    if (len != ANNOUNCE_LEN || p[6] >= SHORT_ADDRS || memcmp(p, mac_self, 6) == 0) return;
+    uint8_t addr = p[6];
+
+    // Someone else claims our address: the higher MAC moves on
+    if (shortAnnounced && addr == shortSelf) {
+        shortCollisions++;
+        memcpy(peers[addr].mac, p, 6);
+        peers[addr].lastSeenUs = now;
+        if (memcmp(mac_self, p, 6) > 0) {
+            short_announce(now);
+            ui_post(UI_SERIAL, "Short address %u taken, moved to %u\n", addr, shortSelf);
+        }
+        return;
+    }
+
+    // The sender may have moved; free its old slot
+    for (int i = 0; i < SHORT_ADDRS; i++) {
+        if (i != addr && peers[i].lastSeenUs && memcmp(peers[i].mac, p, 6) == 0) peers[i].lastSeenUs = 0;
+    }
+    if (peer_live(&peers[addr], now) && memcmp(peers[addr].mac, p, 6) != 0) shortCollisions++;
+    memcpy(peers[addr].mac, p, 6);
+    peers[addr].lastSeenUs = now;
+}
+
+static void short_handle_beacon(uint8_t code, int64_t now)
+{
+    if (__builtin_parity(code)) return; // bit error
+    peer_t *peer = &peers[code & 0x7F];
+    if (!peer_live(peer, now)) {
+        shortUnknown++;
+        return;
+    }
+    peer->lastSeenUs = now;
+    shortBeaconsHeard++;
+    log_sighting(peer->mac, 0, now);
+
+    const uint8_t *m = peer->mac;
+    ui_post(UI_SERIAL, "Received MAC: %02X:%02X:%02X:%02X:%02X:%02X (short %u)\n",
+            m[0], m[1], m[2], m[3], m[4], m[5], code & 0x7F);
+    ui_post(UI_LCD, "Recv MAC: %02X:%02X:%02X:%02X:%02X:%02X\n", m[0], m[1], m[2], m[3], m[4], m[5]);
+}
+
+// ======================================================================
+// Control frames
+// ======================================================================
+
+typedef struct {
+    uint32_t baud;
+    uint8_t channel;
+    uint8_t lineCode;
+    uint32_t beaconPeriodMs; // 0: beacons on button press only
+} link_cfg_t;
+
+#if COORDINATOR
+static const link_cfg_t CTRL_PRESETS[] = {
+    { 2400, 3, LINE_UART_NRZ, 10000 },
+    { 1200, 3, LINE_UART_NRZ, 5000 },
+    { 2400, 3, LINE_UART_NRZ, 2000 },
+};
+#define CTRL_PRESET_COUNT (sizeof(CTRL_PRESETS) / sizeof(CTRL_PRESETS[0]))
+static size_t ctrlPreset = 0;
+static int ctrlRepeatsLeft = 0;
+static int64_t ctrlNextTxUs = 0;
+#endif
+
+static link_cfg_t cfgActive = { BAUD_RATE_DEFAULT, CARRIER_CHANNEL_DEFAULT, LINE_UART_NRZ,
+                                LOW_POWER_MODE ? LOW_POWER_BEACON_US / 1000 : 0 };
+static link_cfg_t cfgPrevious;   // restored if the new settings hear nothing
+static link_cfg_t cfgPending;
+static bool cfgPendingValid = false;
+static int64_t cfgSwitchAtUs = 0;
+static uint8_t cfgEpoch = 0;     // of the newest announcement seen
+static bool cfgProbation = false;
+static int64_t cfgAppliedUs = 0;
+static int64_t lastGoodFrameUs = 0;
+static uint32_t cfgTxAbandoned = 0; // frames cut off by a switch
+
+static int64_t beaconPeriodUs = LOW_POWER_MODE ? LOW_POWER_BEACON_US : 0;
+static int64_t nextBeaconUs = 0; // 0: no periodic beacon
+
+static portMUX_TYPE cfgMux = portMUX_INITIALIZER_UNLOCKED;
+
+static bool link_cfg_same(const link_cfg_t *a, const link_cfg_t *b)
+{
+    return a->baud == b->baud && a->channel == b->channel && a->lineCode == b->lineCode &&
+           a->beaconPeriodMs == b->beaconPeriodMs;
+}
+
+// Only what the fixed 38 kHz demodulator on IR_RX_GPIO can pass: above
+// 2400 baud a bit is too few carrier cycles for it, and another carrier
+// would leave the node deaf to its own group.
+static bool link_cfg_valid(const link_cfg_t *cfg)
+{
+    switch (cfg->baud) {
+    case 1200: case 2400:
+        break;
+    default:
+        return false;
+    }
+    return cfg->channel == CARRIER_CHANNEL_DEFAULT && cfg->lineCode == LINE_UART_NRZ;
+}
+
+// Switch every link parameter at once. The bit clocks read baudRate and
+// bitDuration* per bit, so they are changed together with the link ISRs
+// held off (they run on this core) and any byte in progress dropped; the next
+// start bit is timed at the new rate. Only the frame already on air is let
+// finish: the frames queued behind it go out at the new rate. Link task only.
+static void apply_link_cfg(const link_cfg_t *cfg, int64_t now)
+{
+    // At most one frame's airtime; a frame still going after that (a wedged
+    // bit clock) is cut off rather than holding the switch
+    txHold = true;
+    int64_t giveUpUs = esp_timer_get_time() + frame_airtime_us(WAKE_PREAMBLE_BYTES + TX_FRAME_MAX) + 10000;
+    while (transmitting && esp_timer_get_time() < giveUpUs) vTaskDelay(pdMS_TO_TICKS(1));
+
+    portENTER_CRITICAL(&cfgMux);
+    bool abandoned = transmitting;
+    if (abandoned) {
+        carrier_gate(false);
+        __atomic_store_n(&txTail, txTail + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&transmitting, false, __ATOMIC_SEQ_CST);
+    }
+    disarm_byte();
+    rxState = RX_HUNT;
+    baudRate = cfg->baud;
+    bitDurationUs = 1000000 / cfg->baud;
+    bitDurationRem = 1000000 % cfg->baud;
+    portEXIT_CRITICAL(&cfgMux);
+    if (abandoned) {
+        cfgTxAbandoned++;
+        ui_post(UI_SERIAL, "Link: frame on air cut off at the switch (%lu so far)\n", (unsigned long)cfgTxAbandoned);
+    }
+
+    set_carrier_channel(cfg->channel);
+    txHold = false;
+    if (!tx_queue_empty() && claim_transmitter()) tx_start();
+    beaconPeriodUs = (int64_t)cfg->beaconPeriodMs * 1000;
+    nextBeaconUs = beaconPeriodUs ? now + beaconPeriodUs : 0;
+    cfgActive = *cfg;
+
+    ui_post(UI_SERIAL, "Link: %lu baud, %lu Hz carrier, beacon every %lu ms\n",
+            (unsigned long)cfg->baud, (unsigned long)CARRIER_HZ[cfg->channel],
+            (unsigned long)cfg->beaconPeriodMs);
+    ui_post(UI_LCD, "Link %lu bd %lu kHz\n", (unsigned long)cfg->baud,
+            (unsigned long)(CARRIER_HZ[cfg->channel] / 1000));
+}
+
+static void ctrl_schedule(const link_cfg_t *cfg, int64_t switchAtUs)
+{
+    cfgPending = *cfg;
+    cfgSwitchAtUs = switchAtUs;
+    cfgPendingValid = true;
+}
+
+static void ctrl_handle(const uint8_t *p, size_t len, int64_t rxUs)
+{
+    if (len != CTRL_LEN || memcmp(p, mac_self, 6) == 0) return;
+
+    link_cfg_t cfg;
+    uint8_t epoch = p[6];
+    memcpy(&cfg.baud, &p[7], 4);
+    cfg.channel = p[11];
+    cfg.lineCode = p[12];
+    memcpy(&cfg.beaconPeriodMs, &p[13], 4);
+    uint16_t switchInMs = p[17] | (p[18] << 8);
+
+    if (!link_cfg_valid(&cfg)) {
+        ui_post(UI_SERIAL, "Control: unsupported settings (%lu baud, channel %u, line code %u) ignored\n",
+                (unsigned long)cfg.baud, cfg.channel, cfg.lineCode);
+        return;
+    }
+    // Repeats of an announcement we already applied change nothing. A
+    // restarted coordinator can reuse an epoch, so new settings still count.
+    if (epoch == cfgEpoch && !cfgPendingValid && link_cfg_same(&cfg, &cfgActive)) return;
+
+    cfgEpoch = epoch;
+    ctrl_schedule(&cfg, rxUs + (int64_t)switchInMs * 1000);
+}
+
+#if COORDINATOR
+static void ctrl_announce_next(int64_t now)
+{
+    ctrlPreset = (ctrlPreset + 1) % CTRL_PRESET_COUNT;
+    cfgEpoch++;
+    ctrl_schedule(&CTRL_PRESETS[ctrlPreset], now + CTRL_LEAD_US);
+    ctrlRepeatsLeft = CTRL_REPEATS;
+    ctrlNextTxUs = now;
+}
+
+// Send the next repeat when the queue is idle, so its airtime, and with it
+// the end of frame the receivers count from, is known.
+static void ctrl_send_repeat(int64_t now)
+{
+    if (!ctrlRepeatsLeft || now < ctrlNextTxUs || !tx_queue_empty() || transmitting) return;
+
+    int64_t frameEnd = now + frame_airtime_us(WAKE_PREAMBLE_BYTES + FRAME_OVERHEAD + CTRL_LEN);
+    if (frameEnd >= cfgSwitchAtUs) {
+        ctrlRepeatsLeft = 0;
+        return;
+    }
+
+    uint16_t switchInMs = (uint16_t)((cfgSwitchAtUs - frameEnd) / 1000);
+    uint8_t payload[CTRL_LEN];
+    memcpy(payload, mac_self, 6);
+    payload[6] = cfgEpoch;
+    memcpy(&payload[7], &cfgPending.baud, 4);
+    payload[11] = cfgPending.channel;
+    payload[12] = cfgPending.lineCode;
+    memcpy(&payload[13], &cfgPending.beaconPeriodMs, 4);
+    payload[17] = switchInMs & 0xFF;
+    payload[18] = switchInMs >> 8;
+    if (send_typed(FRAME_CONTROL, payload, sizeof(payload)) < 0) return;
+
+    ctrlRepeatsLeft--;
+    ctrlNextTxUs = now + CTRL_REPEAT_GAP_US;
+}
+#endif
+
+static void ctrl_poll(int64_t now)
+{
+#if COORDINATOR
+    ctrl_send_repeat(now);
+#endif
+    if (cfgPendingValid && now >= cfgSwitchAtUs) {
+        cfgPendingValid = false;
+        cfgPrevious = cfgActive;
+        apply_link_cfg(&cfgPending, now);
+        cfgProbation = true;
+        cfgAppliedUs = now;
+    }
+
+    if (cfgProbation) {
+        if (lastGoodFrameUs > cfgAppliedUs) {
+            cfgProbation = false; // the new settings work
+        } else if (now - cfgAppliedUs >= CTRL_FALLBACK_US) {
+            cfgProbation = false;
+            ui_post(UI_SERIAL, "Link: nothing decoded for %d s after the switch, falling back\n",
+                    CTRL_FALLBACK_US / 1000000);
+            apply_link_cfg(&cfgPrevious, now);
+        }
+    }
+}
+
+// Earliest moment ctrl_poll() has something to do
+static int64_t ctrl_next_event(int64_t until)
+{
+    if (cfgPendingValid && cfgSwitchAtUs < until) until = cfgSwitchAtUs;
+    if (cfgProbation && cfgAppliedUs + CTRL_FALLBACK_US < until) until = cfgAppliedUs + CTRL_FALLBACK_US;
+#if COORDINATOR
+    if (ctrlRepeatsLeft && ctrlNextTxUs < until) until = ctrlNextTxUs;
+#endif
+    return until;
+}
+
+// ======================================================================
+// Low power
+// ======================================================================
+
+static int64_t sleptUs = 0;
+static uint32_t wakeups = 0;
+static uint32_t wakeupsGpio = 0;
+static int64_t powerSinceUs = 0;
+
+static const gpio_num_t BUTTONS[] = { BUTTON_A_GPIO, BUTTON_B_GPIO, BUTTON_C_GPIO };
+
+static bool any_button_down()
+{
+    for (gpio_num_t pin : BUTTONS) {
+        if (!gpio_get_level(pin)) return true;
+    }
+    return false;
+}
+
+// Nothing on the air, nothing queued either way, no transfer waiting on
+// a timely ACK
+static bool link_quiet(int64_t now)
+{
+    return !transmitting && tx_queue_empty() && rx_line_quiet(now) &&
+           uxQueueMessagesWaiting(rxQueue) == 0 &&
+           !arqTx.active && !arqRx.ackPending && !(arqRx.active && !arqRx.complete);
+}
+
+// Quiet, and nothing left for the UI or the log to do either
+static bool link_idle(int64_t now)
+{
+    return link_quiet(now) &&
+           ui_pipe_empty(&uiPipe) && ui_pipe_empty(&logUiPipe) &&
+           logHead == __atomic_load_n(&logTail, __ATOMIC_ACQUIRE);
+}
+
+static int64_t next_wakeup(int64_t until)
+{
+    until = ctrl_next_event(until);
+    if (ping.active && ping.lastPingUs + PING_INTERVAL_US < until) until = ping.lastPingUs + PING_INTERVAL_US;
+    for (int i = 0; i < FLOOD_PENDING; i++) {
+        if (floodPending[i].used && floodPending[i].dueUs < until) until = floodPending[i].dueUs;
+    }
+    return until;
+}
+
+// Light-sleep both cores until 'until' or the first IR edge / button press.
+// gpio_wakeup_enable() reprograms the pin's interrupt type, so the RX edge
+// interrupt is parked while asleep and restored afterwards. Returns false
+// if it did not sleep.
+static bool light_sleep_until(int64_t until, int64_t now)
+{
+    int64_t span = until - now;
+    if (span < SLEEP_MIN_US) return false;
+    if (span > SLEEP_MAX_US) span = SLEEP_MAX_US;
+
+#if CONFIG_ESP_CONSOLE_UART
+    uart_wait_tx_idle_polling((uart_port_t)CONFIG_ESP_CONSOLE_UART_NUM);
+#endif
+    gpio_intr_disable(IR_RX_GPIO);
+    gpio_wakeup_enable(IR_RX_GPIO, GPIO_INTR_LOW_LEVEL); // idle high, start bit low
+
+    // A held button would wake us again at once; arm it after release
+    for (gpio_num_t pin : BUTTONS) {
+        if (gpio_get_level(pin)) gpio_wakeup_enable(pin, GPIO_INTR_LOW_LEVEL);
+        else gpio_wakeup_disable(pin);
+    }
+    esp_sleep_enable_timer_wakeup(span);
+
+    int64_t before = esp_timer_get_time();
+    esp_light_sleep_start();
+    int64_t after = esp_timer_get_time();
+
+    gpio_wakeup_disable(IR_RX_GPIO);
+    gpio_set_intr_type(IR_RX_GPIO, GPIO_INTR_ANYEDGE);
+    gpio_intr_enable(IR_RX_GPIO);
+
+    sleptUs += after - before;
+    wakeups++;
+    if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO) wakeupsGpio++;
+    return true;
+}
+
+static void power_report(int64_t now)
+{
+    int64_t span = now - powerSinceUs;
+    if (span <= 0) return;
+    ui_post(UI_SERIAL, "Power: awake %lu.%lu%%, %lu.%lu wakeups/s (%lu by GPIO)\n",
+            (unsigned long)((span - sleptUs) * 100 / span), (unsigned long)((span - sleptUs) * 1000 / span % 10),
+            (unsigned long)((int64_t)wakeups * 1000000 / span),
+            (unsigned long)((int64_t)wakeups * 10000000 / span % 10), (unsigned long)wakeupsGpio);
+    sleptUs = 0;
+    wakeups = wakeupsGpio = 0;
+    powerSinceUs = now;
+}
+
+// ======================================================================
+// Setup
+// ======================================================================
+
+void setup_ledc()
+{
+    ledc_timer_config_t ledc_timer_conf = {
+        .speed_mode = LEDC_HIGH_SPEED_MODE,
+        .duty_resolution = LEDC_RES,
+        .timer_num = LEDC_TIMER,
+        .freq_hz = CARRIER_HZ[carrierChannel],
+        .clk_cfg = LEDC_AUTO_CLK
+    };
+    ledc_timer_config(&ledc_timer_conf);
+
+    ledc_channel_config_t ledc_channel_conf = {
+        .gpio_num = IR_TX_GPIO,
+        .speed_mode = LEDC_HIGH_SPEED_MODE,
+        .channel = LEDC_CHANNEL,
+        .intr_type = LEDC_INTR_DISABLE,
+        .timer_sel = LEDC_TIMER,
+        .duty = 128,
+        .hpoint = 0
+    };
+    ledc_channel_config(&ledc_channel_conf);
+
+    // Carrier runs continuously; bits only switch the pin's matrix source
+    gpio_set_level(IR_TX_GPIO, 0);
+    esp_rom_gpio_connect_out_signal(IR_TX_GPIO, LEDC_HS_SIG_OUT0_IDX + LEDC_CHANNEL, false, false);
+    carrierOnSel = REG_READ(IR_TX_OUT_SEL_REG);
+    esp_rom_gpio_connect_out_signal(IR_TX_GPIO, SIG_GPIO_OUT_IDX, false, false);
+    carrierOffSel = REG_READ(IR_TX_OUT_SEL_REG);
+}
+
+void setup_timers()
+{
+    gptimer_config_t timer_config = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = 1000000 // 1 MHz
+    };
+
+    // TX: free-running counter, one-shot alarms re-armed per bit
+    ESP_ERROR_CHECK(gptimer_new_timer(&timer_config, &tx_timer));
+    gptimer_event_callbacks_t tx_cbs = { .on_alarm = on_tx_timer };
+    ESP_ERROR_CHECK(gptimer_register_event_callbacks(tx_timer, &tx_cbs, NULL));
+    ESP_ERROR_CHECK(gptimer_enable(tx_timer));
+    ESP_ERROR_CHECK(gptimer_start(tx_timer));
+
+    // RX: stopped until a start-bit edge arms it
+    ESP_ERROR_CHECK(gptimer_new_timer(&timer_config, &rx_timer));
+    gptimer_event_callbacks_t rx_cbs = { .on_alarm = on_rx_timer };
+    ESP_ERROR_CHECK(gptimer_register_event_callbacks(rx_timer, &rx_cbs, NULL));
+    ESP_ERROR_CHECK(gptimer_enable(rx_timer));
+}
+
+// The GPTimers are started, stopped and re-phased from ISRs, so the build
+// needs CONFIG_GPTIMER_CTRL_FUNC_IN_IRAM (and CONFIG_GPTIMER_ISR_IRAM_SAFE).
+void setup_rx_gpio()
+{
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 1ULL << IR_RX_GPIO,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_ANYEDGE
+    };
+    gpio_config(&io_conf);
+
+    ESP_ERROR_CHECK(gpio_install_isr_service(ESP_INTR_FLAG_IRAM));
+    ESP_ERROR_CHECK(gpio_isr_handler_add(IR_RX_GPIO, on_rx_edge, NULL));
+}
+
+void setup_buttons()
+{
+    gpio_config_t btn_conf = {};
+    btn_conf.pin_bit_mask = (1ULL << BUTTON_A_GPIO) | (1ULL << BUTTON_B_GPIO) |
+                            (1ULL << BUTTON_C_GPIO);
+    btn_conf.mode = GPIO_MODE_INPUT;
+    btn_conf.pull_up_en = GPIO_PULLUP_ENABLE;
+    gpio_config(&btn_conf);
+}
+
+// The IR pin and the buttons are armed per sleep in light_sleep_until()
+void setup_sleep()
+{
+    ESP_ERROR_CHECK(esp_sleep_enable_gpio_wakeup());
+}
+
+// ======================================================================
+// Main
+// ======================================================================
+
+static void handle_frame(const rx_frame_t *frame)
+{
+    if (frame->type == SYNC2) {
+        if (memcmp(frame->payload, mac_self, 6) == 0) return;
+        lastGoodFrameUs = frame->time_us;
+        log_sighting(frame->payload, 0, frame->time_us);
+        const uint8_t *m = frame->payload;
+        ui_post(UI_SERIAL, "Received MAC: %02X:%02X:%02X:%02X:%02X:%02X\n", m[0], m[1], m[2], m[3], m[4], m[5]);
+        ui_post(UI_LCD, "Recv MAC: %02X:%02X:%02X:%02X:%02X:%02X\n", m[0], m[1], m[2], m[3], m[4], m[5]);
+        return;
+    }
+    if (frame->type == SHORT_BEACON) {
+        if (!__builtin_parity(frame->payload[0])) lastGoodFrameUs = frame->time_us;
+        short_handle_beacon(frame->payload[0], frame->time_us);
+        return;
+    }
+
+    uint8_t hdr[2] = { frame->type, frame->len };
+    uint8_t crc = crc8(crc8(0, hdr, 2), frame->payload, frame->len);
+    if (crc != frame->crc) {
+        ui_post(UI_SERIAL, "Dropped frame '%c': bad CRC\n", frame->type);
+        return;
+    }
+    lastGoodFrameUs = frame->time_us;
+
+    switch (frame->type) {
+    case FRAME_DATA: arq_handle_data(frame->payload, frame->len, frame->time_us); break;
+    case FRAME_ACK:  arq_handle_ack(frame->payload, frame->len); break;
+    case FRAME_PING: ping_handle_request(frame->payload, frame->len); break;
+    case FRAME_ECHO: ping_handle_echo(frame->payload, frame->len, frame->time_us); break;
+    case FRAME_FLOOD: flood_handle(frame->payload, frame->len, frame->time_us); break;
+    case FRAME_ANNOUNCE: short_handle_announce(frame->payload, frame->len, frame->time_us); break;
+    case FRAME_CONTROL: ctrl_handle(frame->payload, frame->len, frame->time_us); break;
+    default: break;
+    }
+}
+
+static void jitter_report()
+{
+    portENTER_CRITICAL(&sampleLateMux);
+    uint32_t count = sampleLateCount, sum = sampleLateSum, max = sampleLateMax;
+    sampleLateCount = sampleLateSum = sampleLateMax = 0;
+    portEXIT_CRITICAL(&sampleLateMux);
+
+    ui_post(UI_SERIAL, "RX jitter (%s): sample ISR late avg %lu max %lu us over %lu bits; "
+            "dispatch avg %lu max %lu us over %lu frames; %lu UI lines dropped\n",
+            PIPELINE_PINNED ? "pinned" : "unpinned",
+            (unsigned long)(count ? sum / count : 0), (unsigned long)max, (unsigned long)count,
+            (unsigned long)(dispatchCount ? dispatchSum / dispatchCount : 0),
+            (unsigned long)dispatchMax, (unsigned long)dispatchCount, (unsigned long)uiPipe.dropped);
+    dispatchMax = dispatchSum = dispatchCount = 0;
+}
+
+static void run_command(uint8_t cmd, int64_t now)
+{
+    static uint8_t testBlob[ARQ_TEST_BYTES];
+    static bool blobReady = false;
+
+    switch (cmd) {
+    case CMD_BEACON:
+#if SHORT_ADDR_MODE
+        short_send_beacon(now);
+        ui_post(UI_SERIAL, "Short beacons: %lu sent, %lu heard, %lu unknown, %lu collisions; %u vs %u bytes on air\n",
+                (unsigned long)shortBeaconsSent, (unsigned long)shortBeaconsHeard,
+                (unsigned long)shortUnknown, (unsigned long)shortCollisions, 3, (unsigned)sizeof(beacon));
+#elif RELAY_MODE
+        flood_send_beacon(now);
+        flood_report(now);
+#else
+        send_frame(beacon, sizeof(beacon), NULL, NULL);
+#endif
+        ui_post(UI_LCD, "Beacon sent\n");
+        break;
+    case CMD_ARQ:
+        if (!blobReady) {
+            for (size_t i = 0; i < sizeof(testBlob); i++) testBlob[i] = (uint8_t)(i * 7 + 1);
+            blobReady = true;
+        }
+        if (arq_send(testBlob, sizeof(testBlob))) {
+            ui_post(UI_SERIAL, "ARQ TX: %u bytes in %u fragments\n", (unsigned)arqTx.len, arqTx.nfrags);
+            ui_post(UI_LCD, "ARQ TX started\n");
+        }
+        break;
+    case CMD_PING:
+        if (ping.active) {
+            ping.active = false;
+            ping_report(now);
+        } else {
+            ping_start();
+        }
+        break;
+    case CMD_RECONFIG:
+#if COORDINATOR
+        ctrl_announce_next(now);
+        ui_post(UI_SERIAL, "Control: switching to preset %u in %d ms\n",
+                (unsigned)ctrlPreset, CTRL_LEAD_US / 1000);
+        ui_post(UI_LCD, "Reconfig in %d s\n", CTRL_LEAD_US / 1000000);
+#endif
+        break;
+    }
+}
+
+// Link side: owns the timers, the RX GPIO interrupt and every protocol state
+// machine. Talks to the UI only through uiRing and cmdRing.
+static void link_task(void*)
+{
+    setup_timers();
+    setup_rx_gpio();
+#if LOW_POWER_MODE
+    setup_sleep();
+#endif
+    if (beaconPeriodUs) nextBeaconUs = esp_timer_get_time() + beaconPeriodUs;
+#if COORDINATOR
+    cfgEpoch = esp_random(); // unlikely to repeat the epoch nodes last applied
+#endif
+
+    int64_t nextReport = esp_timer_get_time() + JITTER_REPORT_US;
+    while (1) {
+        // Block on the receive queue rather than sleeping, so replies
+        // (ACKs, echoes) go out as soon as a frame is decoded.
+        // Wake in time for a scheduled settings switch
+        TickType_t wait = pdMS_TO_TICKS(10);
+        if (cfgPendingValid) {
+            int64_t left = cfgSwitchAtUs - esp_timer_get_time();
+            if (left < 10000) wait = left > 0 ? pdMS_TO_TICKS(left / 1000) : 0;
+        }
+        rx_frame_t frame;
+        if (xQueueReceive(rxQueue, &frame, wait)) {
+            do {
+                uint32_t delay = (uint32_t)(esp_timer_get_time() - frame.time_us);
+                if (delay > dispatchMax) dispatchMax = delay;
+                dispatchSum += delay;
+                dispatchCount++;
+                handle_frame(&frame);
+            } while (xQueueReceive(rxQueue, &frame, 0));
+        }
+        int64_t now = esp_timer_get_time();
+
+        uint8_t cmd;
+        while (cmd_next(&cmd)) run_command(cmd, now);
+
+        arq_tx_poll(now);
+        arq_rx_poll(now);
+        ping_poll(now);
+        flood_poll(now);
+        ctrl_poll(now);
+        __atomic_store_n(&linkQuiet, link_quiet(now), __ATOMIC_RELEASE);
+
+        if (now >= nextReport) {
+            jitter_report();
+#if LOW_POWER_MODE
+            power_report(now);
+#endif
+            nextReport = now + JITTER_REPORT_US;
+        }
+
+        if (nextBeaconUs && now >= nextBeaconUs) {
+            run_command(CMD_BEACON, now);
+            nextBeaconUs = now + beaconPeriodUs;
+        }
+
+#if LOW_POWER_MODE
+        // ui_task and log_task stay parked across timer wakeups; an IR edge,
+        // a button (pressed, or still held from before) or anything to show
+        // or log lets them run again
+        if (!link_idle(now)) {
+            task_unpark(&uiPark);
+            task_unpark(&logPark);
+        } else {
+            bool parked = task_park(&uiPark);
+            parked = task_park(&logPark) && parked;
+            if (parked) {
+                int64_t until = nextBeaconUs && nextBeaconUs < nextReport ? nextBeaconUs : nextReport;
+                if (!light_sleep_until(next_wakeup(until), now) ||
+                    esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO || any_button_down()) {
+                    task_unpark(&uiPark);
+                    task_unpark(&logPark);
+                }
+            }
+        }
+#endif
+    }
+}
+
+static bool button_pressed(gpio_num_t pin)
+{
+    if (gpio_get_level(pin) != 0) return false;
+    while (gpio_get_level(pin) == 0) vTaskDelay(pdMS_TO_TICKS(10)); // wait for release
+    return true;
+}
+
+// UI side: display, buttons and the serial console
+static void ui_task(void*)
+{
+    display.begin();
+    display.setTextSize(2);
+    display.setTextColor(TFT_WHITE, TFT_BLACK);
+    display.fillScreen(TFT_BLACK);
+    display.setCursor(0, 0);
+    display.println("IR Node (ZT + ARQ + ping + relay)");
+
+    while (1) {
+        ui_msg_t msg;
+        while (ui_next(&uiPipe, &msg) || ui_next(&logUiPipe, &msg)) {
+            if (msg.dest & UI_SERIAL) fputs(msg.text, stdout);
+            if (msg.dest & UI_CLEAR) {
+                display.fillScreen(TFT_BLACK);
+                display.setCursor(0, 0);
+            }
+            if (msg.dest & UI_LCD) display.print(msg.text);
+        }
+
+        if (button_pressed(BUTTON_A_GPIO)) cmd_post(CMD_BEACON);
+        if (button_pressed(BUTTON_B_GPIO)) cmd_post(CMD_ARQ);
+        if (button_pressed(BUTTON_C_GPIO)) cmd_post(COORDINATOR ? CMD_RECONFIG : CMD_PING);
+
+#if UI_STRESS
+        static uint16_t shade = 0;
+        display.fillRect(0, display.height() / 2, display.width(), display.height() / 2, shade += 0x0841);
+        vTaskDelay(1); // one tick for IDLE0, or the task watchdog fires
+#else
+        vTaskDelay(pdMS_TO_TICKS(20));
+#endif
+#if LOW_POWER_MODE
+        park_point(&uiPark);
+#endif
+    }
+}
+
+extern "C" void app_main(void)
+{
+    esp_read_mac(mac_self, ESP_MAC_WIFI_STA);
+    beacon[0] = SYNC1;
+    beacon[1] = SYNC2;
+    memcpy(&beacon[2], mac_self, 6);
+
+    rxQueue = xQueueCreate(RX_QUEUE_LEN, sizeof(rx_frame_t));
+    setup_buttons();
+    setup_ledc();
+
+#if PIPELINE_PINNED
+    xTaskCreatePinnedToCore(link_task, "link", 4096, NULL, LINK_TASK_PRIO, NULL, LINK_CORE);
+    xTaskCreatePinnedToCore(ui_task, "ui", 4096, NULL, UI_TASK_PRIO, &uiPark.task, UI_CORE);
+    xTaskCreatePinnedToCore(log_task, "log", 4096, NULL, LOG_TASK_PRIO, &logPark.task, UI_CORE);
+#else
+    xTaskCreatePinnedToCore(link_task, "link", 4096, NULL, UI_TASK_PRIO, NULL, tskNO_AFFINITY);
+    xTaskCreatePinnedToCore(ui_task, "ui", 4096, NULL, UI_TASK_PRIO, &uiPark.task, tskNO_AFFINITY);
+    xTaskCreatePinnedToCore(log_task, "log", 4096, NULL, LOG_TASK_PRIO, &logPark.task, tskNO_AFFINITY);
+#endif
+}
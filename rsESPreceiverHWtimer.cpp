@@ -1,6 +1,6 @@
 //This code is for the ESP-IDF framework. 
-//It is a receiver that uses LEDC and the hardware timer to receive signals.
-//It looks for the "ZT" preamble and filters out self signals.
+//It is a receiver that uses the hardware timer (or, with RX_BACKEND_UART, the UART peripheral) to receive signals.
+//It looks for the "ZT" preamble, detects the sender's baud rate from it and filters out self signals.
 #include <stdio.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
@@ -9,15 +9,41 @@
 #include "driver/gptimer.h"
 #include "esp_system.h"
 #include "esp_mac.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "driver/uart.h"
 #include "M5GFX.h"
 
 #define IR_RX_GPIO GPIO_NUM_36
-#define BAUD_RATE 2400
-#define BIT_DURATION_US (1000000 / BAUD_RATE)
+
+// 1: bytes come from the UART peripheral (RX FIFO + event queue)
+// 0: bits are sampled by the edge-armed GPTimer
+#define RX_BACKEND_UART 0
+
+// UART backend settings. The UART does not detect the rate, so it is fixed.
+#define IR_UART_NUM UART_NUM_2
+#define UART_RX_BAUD 2400
+#define UART_RX_FULL_THRESH 8  // FIFO bytes before an interrupt: one ZT+MAC frame
+#define UART_RX_TOUT_SYMBOLS 3 // idle byte times before the timeout interrupt
+#define UART_EVENT_QUEUE_LEN 16
+
+// The line rate is not fixed at compile time: each frame's 'Z' byte is timed
+// and the sampling clock locks to the nearest supported rate (see on_rx_edge).
+#define BAUD_TOLERANCE_PCT 5 // max deviation of a measured rate from a supported one
+#define FRAME_GAP_BITS 24    // edge-free bit times after which a locked rate is dropped
 
 #define SYNC1 0x5A // 'Z'
 #define SYNC2 0x54 // 'T'
 
+// Edge positions (in bit times from the start-bit edge) of the 'Z' byte,
+// LSB first with start/stop bits: fall 0, rise 2, fall 3, rise 4,
+// fall 6, rise 7, fall 8, rise 9.
+#define PREAMBLE_EDGES 8
+#define PREAMBLE_SPAN_BITS 9
+
+static const DRAM_ATTR uint32_t SUPPORTED_BAUDS[] = { 2400, 4800, 9600, 14400, 19200, 28800, 38400 };
+static const DRAM_ATTR uint8_t SYNC1_EDGE_POS[PREAMBLE_EDGES] = { 0, 2, 3, 4, 6, 7, 8, 9 };
+
 M5GFX display;
 
 volatile bool receiving = false;
@@ -31,21 +57,222 @@ volatile bool macReady = false;
 
 uint8_t mac_self[6];
 
+gptimer_handle_t gptimer = NULL;
+volatile uint32_t bitPhaseRem = 0; // fractional bit clock accumulator
+
+// Current line rate, set when the preamble is recognised
+volatile bool baudLocked = false;
+volatile uint32_t baudRate = 2400;
+volatile uint32_t bitDurationUs = 1000000 / 2400;  // whole µs per bit
+volatile uint32_t bitDurationRem = 1000000 % 2400; // fractional part, in 1/baudRate µs
+volatile uint32_t frameBaud = 0; // rate the last complete frame arrived at
+
+// Preamble hunter: timestamps of the most recent edges, oldest first
+volatile int64_t edgeTimes[PREAMBLE_EDGES];
+volatile int edgeCount = 0;
+volatile int64_t lastEdgeUs = 0;
+
+volatile int64_t armEdgeUs = 0;      // time of the start edge of the current byte
+volatile uint32_t samplePeriod = 0;  // current alarm period of the sampling timer
+
+// Receive cost, to compare backends: CPU cycles spent per received byte
+volatile uint32_t rxCycles = 0;
+volatile uint32_t rxBytes = 0;
+volatile uint32_t framingErrors = 0; // UART backend only
+volatile uint32_t rxOverflows = 0;   // UART backend only
+
+static QueueHandle_t uartQueue = NULL;
+
 // ----------------------
-// Timer ISR for sampling
+// Fractional bit clock
+// ----------------------
+// bitDurationUs or +1 tick, so the average sampling period is exact
+static inline uint32_t IRAM_ATTR next_bit_step() {
+    uint32_t step = bitDurationUs;
+    bitPhaseRem += bitDurationRem;
+    if (bitPhaseRem >= baudRate) {
+        bitPhaseRem -= baudRate;
+        step++;
+    }
+    return step;
+}
+
+// ----------------------
+// ZT frame parser
+// ----------------------
+// Fed one byte at a time by whichever backend is receiving. Returns false
+// once the current frame is complete or sync is lost.
+static bool IRAM_ATTR zt_feed_byte(uint8_t byte) {
+    rxBytes++;
+
+    if (syncState == 0 && byte == SYNC1) {
+        syncState = 1;
+        return true;
+    }
+    if (syncState == 1 && byte == SYNC2) {
+        syncState = 2;
+        macIndex = 0;
+        return true;
+    }
+    if (syncState == 2) {
+        mac[macIndex++] = byte;
+        if (macIndex < 6) return true;
+        frameBaud = baudRate;
+        macReady = true;
+    }
+    syncState = 0;
+    return false;
+}
+
+// ----------------------
+// Sampling timer control
+// ----------------------
+// The GPTimer only runs while a byte is in flight: a start-bit edge arms
+// it and it stops itself after sampling the stop bit. Between frames the
+// CPU sees no sampling interrupts at all.
+static inline void IRAM_ATTR set_sample_period(uint32_t ticks) {
+    samplePeriod = ticks;
+    gptimer_alarm_config_t alarm_config = {
+        .alarm_count = ticks,
+        .reload_count = 0,
+        .flags = { .auto_reload_on_alarm = true }
+    };
+    gptimer_set_alarm_action(gptimer, &alarm_config);
+}
+
+static void IRAM_ATTR arm_byte(int64_t now) {
+    receiving = true;
+    bitIndex = 0;
+    currentByte = 0;
+    armEdgeUs = now;
+    bitPhaseRem = 0;
+
+    // First sample 1.5 bits after the start edge lands mid data bit 0
+    set_sample_period(bitDurationUs + bitDurationUs / 2);
+    gptimer_set_raw_count(gptimer, 0);
+    gptimer_start(gptimer);
+}
+
+static void IRAM_ATTR disarm_byte() {
+    if (receiving) gptimer_stop(gptimer);
+    receiving = false;
+    bitIndex = -1;
+    currentByte = 0;
+}
+
+// ----------------------
+// Baud lock / unlock
+// ----------------------
+static void IRAM_ATTR lock_baud(uint32_t baud) {
+    baudRate = baud;
+    bitDurationUs = 1000000 / baud;
+    bitDurationRem = 1000000 % baud;
+
+    // The 'Z' byte has been consumed from its edges; we are now at the start
+    // of its stop bit, so the next falling edge is the start bit of 'T'.
+    disarm_byte();
+    syncState = 1;
+    baudLocked = true;
+}
+
+static void IRAM_ATTR unlock_baud() {
+    disarm_byte();
+    baudLocked = false;
+    edgeCount = 0;
+    syncState = 0;
+}
+
+// ----------------------
+// Preamble rate detection
+// ----------------------
+// Matches the last PREAMBLE_EDGES edges against the 'Z' edge pattern. Each
+// edge must sit within a quarter bit of its expected position, then the
+// 9-bit span gives the rate, which must be close to a supported one.
+static uint32_t IRAM_ATTR detect_preamble_baud() {
+    int64_t span = edgeTimes[PREAMBLE_EDGES - 1] - edgeTimes[0];
+    if (span <= 0) return 0;
+
+    for (int i = 1; i < PREAMBLE_EDGES - 1; i++) {
+        int64_t err = (edgeTimes[i] - edgeTimes[0]) * PREAMBLE_SPAN_BITS
+                    - (int64_t)SYNC1_EDGE_POS[i] * span;
+        if (err < 0) err = -err;
+        if (err * 4 > span) return 0;
+    }
+
+    uint32_t measured = (uint32_t)((PREAMBLE_SPAN_BITS * 1000000LL) / span);
+    for (size_t i = 0; i < sizeof(SUPPORTED_BAUDS) / sizeof(SUPPORTED_BAUDS[0]); i++) {
+        uint32_t baud = SUPPORTED_BAUDS[i];
+        uint32_t diff = measured > baud ? measured - baud : baud - measured;
+        if (diff * 100 <= baud * BAUD_TOLERANCE_PCT) return baud;
+    }
+    return 0;
+}
+
 // ----------------------
-static bool IRAM_ATTR on_bit_timer(gptimer_handle_t, const gptimer_alarm_event_data_t*, void*) {
+// Edge ISR
+// ----------------------
+// Unlocked: edges are timestamped and matched against the preamble.
+// Locked and idle: a falling edge is a start bit and arms the sampling timer.
+// Locked mid-byte: every transition marks a bit boundary, so pull the
+// sampling clock back to half a bit after it (clock recovery), whatever the
+// drift between our crystal and the sender's.
+static void IRAM_ATTR handle_rx_edge() {
+    int64_t now = esp_timer_get_time();
     bool level = gpio_get_level(IR_RX_GPIO);
 
-    if (!receiving) {
-        if (level == 0) {
-            receiving = true;
-            bitIndex = 0;
-            currentByte = 0;
+    if (baudLocked && now - lastEdgeUs > (int64_t)FRAME_GAP_BITS * bitDurationUs) {
+        unlock_baud(); // inter-frame timeout: sender went quiet mid-frame
+    }
+    lastEdgeUs = now;
+
+    if (baudLocked) {
+        if (!receiving) {
+            if (!level) arm_byte(now);
         }
-        return false;
+        else if (bitIndex == 0 && level && now - armEdgeUs < bitDurationUs / 2) {
+            disarm_byte(); // start bit shorter than half a bit: glitch
+        }
+        else {
+            gptimer_set_raw_count(gptimer, samplePeriod - bitDurationUs / 2);
+            bitPhaseRem = 0;
+        }
+        return;
+    }
+
+    if (edgeCount == PREAMBLE_EDGES) {
+        for (int i = 1; i < PREAMBLE_EDGES; i++) edgeTimes[i - 1] = edgeTimes[i];
+        edgeCount--;
+    }
+    edgeTimes[edgeCount++] = now;
+
+    // Edges alternate, so a full window ending on a rising edge starts on
+    // a falling (start bit) edge.
+    if (edgeCount == PREAMBLE_EDGES && level) {
+        uint32_t baud = detect_preamble_baud();
+        if (baud) lock_baud(baud);
+    }
+}
+
+static void IRAM_ATTR on_rx_edge(void*) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    handle_rx_edge();
+    rxCycles += esp_cpu_get_cycle_count() - start;
+}
+
+// ----------------------
+// Timer ISR for sampling
+// ----------------------
+static void IRAM_ATTR sample_bit(gptimer_handle_t timer) {
+    bool level = gpio_get_level(IR_RX_GPIO);
+
+    if (!receiving) { // disarmed between the alarm firing and this ISR
+        gptimer_stop(timer);
+        return;
     }
 
+    // Auto-reload picks up the new period for the following bit
+    set_sample_period(next_bit_step());
+
     if (bitIndex >= 0 && bitIndex < 8) {
         currentByte |= (level ? 1 : 0) << bitIndex;
     }
@@ -53,30 +280,63 @@ static bool IRAM_ATTR on_bit_timer(gptimer_handle_t, const gptimer_alarm_event_d
     bitIndex++;
 
     if (bitIndex > 8) { // stop bit
-        receiving = false;
-        bitIndex = -1;
+        uint8_t byte = currentByte;
+        disarm_byte(); // stop sampling until the next start edge
 
-        if (syncState == 0 && currentByte == SYNC1) {
-            syncState = 1;
+        if (!zt_feed_byte(byte)) {
+            unlock_baud(); // next frame may use a different rate
         }
-        else if (syncState == 1 && currentByte == SYNC2) {
-            syncState = 2;
-            macIndex = 0;
-        }
-        else if (syncState == 2) {
-            mac[macIndex++] = currentByte;
-            if (macIndex >= 6) {
-                macReady = true;
-                syncState = 0;
-            }
+    }
+}
+
+static bool IRAM_ATTR on_bit_timer(gptimer_handle_t timer, const gptimer_alarm_event_data_t*, void*) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    sample_bit(timer);
+    rxCycles += esp_cpu_get_cycle_count() - start;
+    return false;
+}
+
+// ----------------------
+// UART receive task
+// ----------------------
+// The UART assembles bytes in hardware and only interrupts when the RX FIFO
+// reaches UART_RX_FULL_THRESH or the line has been idle for
+// UART_RX_TOUT_SYMBOLS byte times. The driver forwards each block through
+// uartQueue; a timeout block ends a burst, so a partial frame is dropped.
+static void uart_rx_task(void*) {
+    uart_event_t event;
+    uint8_t buf[128];
+
+    while (1) {
+        if (!xQueueReceive(uartQueue, &event, portMAX_DELAY)) continue;
+
+        switch (event.type) {
+        case UART_DATA: {
+            // Timed from the ring-buffer read on; the driver ISR that drains
+            // the FIFO into the ring buffer is not visible from here.
+            uint32_t start = esp_cpu_get_cycle_count();
+            size_t want = event.size < sizeof(buf) ? event.size : sizeof(buf);
+            int n = uart_read_bytes(IR_UART_NUM, buf, want, 0);
+            for (int i = 0; i < n; i++) zt_feed_byte(buf[i]);
+            if (event.timeout_flag) syncState = 0; // line idle: frame over
+            rxCycles += esp_cpu_get_cycle_count() - start;
+            break;
         }
-        else {
+        case UART_FRAME_ERR: // stop bit was not high
+            framingErrors++;
             syncState = 0;
+            break;
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+            rxOverflows++;
+            uart_flush_input(IR_UART_NUM);
+            xQueueReset(uartQueue);
+            syncState = 0;
+            break;
+        default:
+            break;
         }
-
-        currentByte = 0;
     }
-    return false;
 }
 
 // ----------------------
@@ -93,7 +353,6 @@ bool isOwnMAC() {
 // Timer setup
 // ----------------------
 void setup_gptimer() {
-    gptimer_handle_t gptimer = NULL;
     gptimer_config_t timer_config = {
         .clk_src = GPTIMER_CLK_SRC_DEFAULT,
         .direction = GPTIMER_COUNT_UP,
@@ -106,15 +365,44 @@ void setup_gptimer() {
     };
     ESP_ERROR_CHECK(gptimer_register_event_callbacks(gptimer, &cbs, NULL));
 
-    gptimer_alarm_config_t alarm_config = {
-        .alarm_count = BIT_DURATION_US,
-        .reload_count = 0,
-        .flags = { .auto_reload_on_alarm = true }
+    // Left stopped: arm_byte() starts it on each start-bit edge
+    ESP_ERROR_CHECK(gptimer_enable(gptimer));
+}
+
+// ----------------------
+// Edge interrupt setup
+// ----------------------
+// The GPTimer is started, stopped and re-phased from this ISR, so the build
+// needs CONFIG_GPTIMER_CTRL_FUNC_IN_IRAM (and CONFIG_GPTIMER_ISR_IRAM_SAFE).
+void setup_edge_isr() {
+    ESP_ERROR_CHECK(gpio_install_isr_service(ESP_INTR_FLAG_IRAM));
+    ESP_ERROR_CHECK(gpio_isr_handler_add(IR_RX_GPIO, on_rx_edge, NULL));
+}
+
+// ----------------------
+// UART setup
+// ----------------------
+// The demodulator output idles high with an active-low start bit, which is
+// plain UART framing, so no signal inversion is needed.
+void setup_uart_rx() {
+    uart_config_t uart_config = {
+        .baud_rate = UART_RX_BAUD,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .rx_flow_ctrl_thresh = 0,
+        .source_clk = UART_SCLK_DEFAULT
     };
-    ESP_ERROR_CHECK(gptimer_set_alarm_action(gptimer, &alarm_config));
+    ESP_ERROR_CHECK(uart_driver_install(IR_UART_NUM, 256, 0, UART_EVENT_QUEUE_LEN, &uartQueue, 0));
+    ESP_ERROR_CHECK(uart_param_config(IR_UART_NUM, &uart_config));
+    ESP_ERROR_CHECK(uart_set_pin(IR_UART_NUM, UART_PIN_NO_CHANGE, IR_RX_GPIO,
+                                 UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+    ESP_ERROR_CHECK(uart_set_rx_full_threshold(IR_UART_NUM, UART_RX_FULL_THRESH));
+    ESP_ERROR_CHECK(uart_set_rx_timeout(IR_UART_NUM, UART_RX_TOUT_SYMBOLS));
 
-    ESP_ERROR_CHECK(gptimer_enable(gptimer));
-    ESP_ERROR_CHECK(gptimer_start(gptimer));
+    baudRate = UART_RX_BAUD;
+    xTaskCreate(uart_rx_task, "uart_rx", 3072, NULL, 12, NULL);
 }
 
 // ----------------------
@@ -129,21 +417,26 @@ extern "C" void app_main(void) {
     display.setCursor(0, 0);
     display.println("IR Receiver (ZT + MAC)");
 
+    // Read our MAC
+    esp_read_mac(mac_self, ESP_MAC_WIFI_STA);
+
+#if RX_BACKEND_UART
+    setup_uart_rx();
+#else
     // Configure IR input
     gpio_config_t io_conf = {
         .pin_bit_mask = 1ULL << IR_RX_GPIO,
         .mode = GPIO_MODE_INPUT,
         .pull_up_en = GPIO_PULLUP_DISABLE,
         .pull_down_en = GPIO_PULLDOWN_DISABLE,
-        .intr_type = GPIO_INTR_DISABLE
+        .intr_type = GPIO_INTR_ANYEDGE
     };
     gpio_config(&io_conf);
 
-    // Read our MAC
-    esp_read_mac(mac_self, ESP_MAC_WIFI_STA);
-
-    // Start sampling
+    // Sampling timer is armed by line edges, it does not free-run
     setup_gptimer();
+    setup_edge_isr();
+#endif
 
     // Main loop
     while (1) {
@@ -168,7 +461,17 @@ extern "C" void app_main(void) {
                     display.print(":");
                 }
             }
-            printf("\n");
+            printf(" @ %lu baud\n", (unsigned long)frameBaud);
+            display.printf("\n@ %lu baud", (unsigned long)frameBaud);
+
+            // Receive-path cost per byte, for comparing RX_BACKEND_UART 0/1.
+            // GPTimer: whole edge and sample ISRs. UART: read + parse only.
+            if (rxBytes) {
+                printf("RX cost: %lu cycles/byte over %lu bytes (%s), %lu framing errors, %lu overflows\n",
+                       (unsigned long)(rxCycles / rxBytes), (unsigned long)rxBytes,
+                       RX_BACKEND_UART ? "UART: excludes driver ISR" : "GPTimer: all RX ISRs",
+                       (unsigned long)framingErrors, (unsigned long)rxOverflows);
+            }
         }
         vTaskDelay(pdMS_TO_TICKS(10));
     }
@@ -1,41 +1,139 @@
 //This code is for the ESP-IDF framework.
 //It sends a signal using LEDC and the hardware timer.
 //It includes the "ZT" preamble and MAC address.
+//Frames are queued with send_frame() and sent back to back; hold button A to stream.
+//The carrier is a runtime channel; button B steps through the channels.
 #include "driver/ledc.h"
 #include "driver/gpio.h"
 #include "driver/gptimer.h"
 #include "esp_system.h"
 #include "esp_mac.h"
+#include "esp_cpu.h"
+#include "esp_rom_gpio.h"
+#include "soc/gpio_reg.h"
+#include "soc/gpio_sig_map.h"
 #include "M5GFX.h" // M5Stack LCD
+#include <stdio.h>
 #include <string.h>
 
 #define IR_TX_GPIO GPIO_NUM_26
 #define BUTTON_A_GPIO GPIO_NUM_39
+#define BUTTON_B_GPIO GPIO_NUM_38
 
 #define BAUD_RATE 2400
-#define BIT_DURATION_US (1000000 / BAUD_RATE) // ~416µs
+#define BIT_DURATION_US (1000000 / BAUD_RATE) // whole µs per bit (416)
+#define BIT_DURATION_REM (1000000 % BAUD_RATE) // fractional part, in 1/BAUD_RATE µs
 #define LEDC_CHANNEL LEDC_CHANNEL_0
 #define LEDC_TIMER   LEDC_TIMER_0
-#define LEDC_FREQ    38000
 #define LEDC_RES     LEDC_TIMER_8_BIT
 
+// Carrier channels (button B)
+#define CARRIER_CHANNELS 6
+static const uint32_t CARRIER_HZ[CARRIER_CHANNELS] = { 30000, 33000, 36000, 38000, 40000, 56000 };
+#define CARRIER_CHANNEL_DEFAULT 3 // 38 kHz
+
+// 1: the carrier runs continuously and each bit only switches the pin's
+//    GPIO-matrix source between the LEDC output and a constant low.
+// 0: each bit goes through ledc_set_duty/ledc_update_duty/ledc_stop.
+#define CARRIER_GATE_MATRIX 1
+#define IR_TX_OUT_SEL_REG (GPIO_FUNC0_OUT_SEL_CFG_REG + 4 * IR_TX_GPIO)
+
+#define TX_QUEUE_LEN 8  // frames; power of two
+#define TX_FRAME_MAX 32 // bytes per frame
+
+// --- TX queue ---
+// Called from the bit ISR once the stop bit of the frame's last byte is on air.
+typedef void (*tx_done_cb_t)(uint32_t frame_id, void *user_ctx);
+
+typedef struct {
+    uint8_t data[TX_FRAME_MAX];
+    uint8_t len;
+    uint32_t id;
+    tx_done_cb_t done_cb;
+    void *user_ctx;
+} tx_frame_t;
+
+// Single-producer (send_frame caller) / single-consumer (bit ISR) ring.
+// txHead is only written by the producer, txTail only by the ISR.
+static tx_frame_t txQueue[TX_QUEUE_LEN];
+static volatile uint32_t txHead = 0;
+static volatile uint32_t txTail = 0;
+static uint32_t nextFrameId = 0;
+
 // --- Globals ---
 M5GFX display;
+static int carrierChannel = CARRIER_CHANNEL_DEFAULT;
 uint8_t packet[8]; // 2-byte preamble + 6-byte MAC
 
-volatile bool transmitting = false;
+volatile bool transmitting = false; // owned by whoever wins the CAS on it
 volatile int bitIndex = 0;
 volatile int byteIndex = 0;
 volatile uint8_t currentByte = 0;
+volatile uint32_t bitPhaseRem = 0; // fractional bit clock accumulator
+
+volatile uint32_t framesSent = 0;
+
+// Precomputed GPIO_FUNCn_OUT_SEL_CFG values for the IR pin
+static DRAM_ATTR uint32_t carrierOnSel = 0;  // routed to the LEDC channel
+static DRAM_ATTR uint32_t carrierOffSel = 0; // routed to GPIO_OUT, held low
+
+// Per-bit ISR cost, in CPU cycles
+volatile uint32_t isrCycles = 0;
+volatile uint32_t isrCyclesMax = 0;
+volatile uint32_t isrCalls = 0;
 
 gptimer_handle_t bit_timer = NULL;
 
+static inline bool IRAM_ATTR claim_transmitter()
+{
+    bool idle = false;
+    return __atomic_compare_exchange_n(&transmitting, &idle, true, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+// --- Fractional bit clock ---
+// Carries the remainder between bits so the average period is exact
+static inline uint32_t IRAM_ATTR next_bit_step()
+{
+    uint32_t step = BIT_DURATION_US;
+    bitPhaseRem += BIT_DURATION_REM;
+    if (bitPhaseRem >= BAUD_RATE) {
+        bitPhaseRem -= BAUD_RATE;
+        step++;
+    }
+    return step;
+}
+
+// --- Carrier gating ---
+static inline void IRAM_ATTR carrier_gate(bool on)
+{
+#if CARRIER_GATE_MATRIX
+    REG_WRITE(IR_TX_OUT_SEL_REG, on ? carrierOnSel : carrierOffSel);
+#else
+    if (on) {
+        ledc_set_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL, 128);
+        ledc_update_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL);
+    } else {
+        ledc_stop(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL, 0);
+    }
+#endif
+}
+
+static inline void IRAM_ATTR account_isr(uint32_t start)
+{
+    uint32_t cycles = esp_cpu_get_cycle_count() - start;
+    isrCycles += cycles;
+    isrCalls++;
+    if (cycles > isrCyclesMax) isrCyclesMax = cycles;
+}
+
 // --- GPTimer ISR ---
 static bool IRAM_ATTR on_bit_timer(gptimer_handle_t timer,
                                    const gptimer_alarm_event_data_t *edata,
                                    void *user_ctx)
 {
     if (!transmitting) return false;
+    uint32_t start = esp_cpu_get_cycle_count();
 
     bool bit;
     if (bitIndex == 0) { // Start bit
@@ -46,29 +144,47 @@ static bool IRAM_ATTR on_bit_timer(gptimer_handle_t timer,
         bit = 1;
     }
 
-    if (bit == 0) {
-        // Turn ON LEDC modulation
-        ledc_set_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL, 128);
-        ledc_update_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL);
-    } else {
-        // Turn OFF LEDC modulation
-        ledc_stop(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL, 0);
-    }
+    carrier_gate(bit == 0); // modulate for 0, silence for 1
 
     bitIndex++;
     if (bitIndex > 9) { // Next byte
+        tx_frame_t *frame = &txQueue[txTail % TX_QUEUE_LEN];
         bitIndex = 0;
         byteIndex++;
-        if (byteIndex < sizeof(packet)) {
-            currentByte = packet[byteIndex];
+        if (byteIndex < frame->len) {
+            currentByte = frame->data[byteIndex];
         } else {
-            // Done sending
-            transmitting = false;
-            ledc_stop(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL, 0);
+            // Frame done: release its slot, then chain straight into the
+            // next queued frame so its start bit follows this stop bit.
+            if (frame->done_cb) frame->done_cb(frame->id, frame->user_ctx);
+            __atomic_store_n(&txTail, txTail + 1, __ATOMIC_RELEASE);
+
+            if (__atomic_load_n(&txHead, __ATOMIC_ACQUIRE) == txTail) {
+                // Queue looks empty: go idle, then re-check in case
+                // send_frame() pushed meanwhile and saw us still busy.
+                __atomic_store_n(&transmitting, false, __ATOMIC_SEQ_CST);
+                if (__atomic_load_n(&txHead, __ATOMIC_SEQ_CST) == txTail ||
+                    !claim_transmitter()) {
+                    carrier_gate(false);
+                    account_isr(start);
+                    return false; // No further alarm until send_frame() re-arms
+                }
+            }
+
+            byteIndex = 0;
+            currentByte = txQueue[txTail % TX_QUEUE_LEN].data[0];
         }
     }
 
-    return true; // Keep timer running
+    // Schedule the next bit edge relative to this alarm, not to "now",
+    // so ISR latency never accumulates into the bit clock.
+    gptimer_alarm_config_t next_alarm = {
+        .alarm_count = edata->alarm_value + next_bit_step()
+    };
+    gptimer_set_alarm_action(timer, &next_alarm);
+
+    account_isr(start);
+    return false;
 }
 
 // --- LEDC Setup ---
@@ -78,7 +194,7 @@ void setup_ledc()
         .speed_mode = LEDC_HIGH_SPEED_MODE,
         .duty_resolution = LEDC_RES,
         .timer_num = LEDC_TIMER,
-        .freq_hz = LEDC_FREQ,
+        .freq_hz = CARRIER_HZ[carrierChannel],
         .clk_cfg = LEDC_AUTO_CLK
     };
     ledc_timer_config(&ledc_timer_conf);
@@ -94,7 +210,29 @@ void setup_ledc()
     };
     ledc_channel_config(&ledc_channel_conf);
 
+#if CARRIER_GATE_MATRIX
+    // Leave the carrier running and let the ROM helper work out both
+    // matrix encodings once, so the ISR only has to write one of them.
+    ledc_set_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL, 128);
+    ledc_update_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL);
+    gpio_set_level(IR_TX_GPIO, 0);
+
+    esp_rom_gpio_connect_out_signal(IR_TX_GPIO, LEDC_HS_SIG_OUT0_IDX + LEDC_CHANNEL, false, false);
+    carrierOnSel = REG_READ(IR_TX_OUT_SEL_REG);
+    esp_rom_gpio_connect_out_signal(IR_TX_GPIO, SIG_GPIO_OUT_IDX, false, false);
+    carrierOffSel = REG_READ(IR_TX_OUT_SEL_REG);
+#else
     ledc_stop(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL, 0);
+#endif
+}
+
+// Retune between frames; only the LEDC divider changes
+void set_carrier_channel(int ch)
+{
+    if (ch < 0 || ch >= CARRIER_CHANNELS) return;
+    while (transmitting) vTaskDelay(pdMS_TO_TICKS(1));
+    ledc_set_freq(LEDC_HIGH_SPEED_MODE, LEDC_TIMER, CARRIER_HZ[ch]);
+    carrierChannel = ch;
 }
 
 // --- GPTimer Setup ---
@@ -114,27 +252,52 @@ void setup_gptimer()
     };
     gptimer_register_event_callbacks(bit_timer, &cbs, NULL);
 
-    gptimer_alarm_config_t alarm_config = {
-        .alarm_count = BIT_DURATION_US,
-        .reload_count = 0,
-        .flags = { .auto_reload_on_alarm = true }
-    };
-    gptimer_set_alarm_action(bit_timer, &alarm_config);
-
+    // The counter free-runs; each bit re-arms a one-shot alarm (no auto-reload)
+    // so the fractional bit period can be applied per bit.
     gptimer_enable(bit_timer);
+    gptimer_start(bit_timer);
 }
 
 // --- Transmission ---
-void start_transmission()
+// Queue a frame for transmission. Returns its id, or -1 if the queue is full
+// or the frame is too long. done_cb (optional, IRAM) runs in the bit ISR once
+// the frame has been sent. Must be called from a single task.
+int32_t send_frame(const uint8_t *data, size_t len, tx_done_cb_t done_cb, void *user_ctx)
 {
-    if (transmitting) return;
+    if (len == 0 || len > TX_FRAME_MAX) return -1;
 
-    transmitting = true;
-    bitIndex = 0;
-    byteIndex = 0;
-    currentByte = packet[0];
+    uint32_t head = txHead;
+    if (head - __atomic_load_n(&txTail, __ATOMIC_ACQUIRE) >= TX_QUEUE_LEN) return -1;
 
-    gptimer_start(bit_timer);
+    tx_frame_t *frame = &txQueue[head % TX_QUEUE_LEN];
+    memcpy(frame->data, data, len);
+    frame->len = len;
+    frame->id = nextFrameId++;
+    frame->done_cb = done_cb;
+    frame->user_ctx = user_ctx;
+    __atomic_store_n(&txHead, head + 1, __ATOMIC_SEQ_CST);
+
+    // Idle transmitter: start the bit clock on this frame. If the ISR is
+    // busy (or wins the race on its final stop bit) it chains the frame.
+    if (claim_transmitter()) {
+        bitIndex = 0;
+        byteIndex = 0;
+        currentByte = frame->data[0];
+        bitPhaseRem = 0;
+
+        uint64_t now = 0;
+        gptimer_get_raw_count(bit_timer, &now);
+        gptimer_alarm_config_t first_alarm = {
+            .alarm_count = now + next_bit_step()
+        };
+        gptimer_set_alarm_action(bit_timer, &first_alarm);
+    }
+    return frame->id;
+}
+
+static void IRAM_ATTR on_frame_sent(uint32_t frame_id, void *user_ctx)
+{
+    framesSent++;
 }
 
 // --- Main ---
@@ -150,7 +313,7 @@ extern "C" void app_main(void)
 
     // Init Button A
     gpio_config_t btn_conf = {};
-    btn_conf.pin_bit_mask = 1ULL << BUTTON_A_GPIO;
+    btn_conf.pin_bit_mask = (1ULL << BUTTON_A_GPIO) | (1ULL << BUTTON_B_GPIO);
     btn_conf.mode = GPIO_MODE_INPUT;
     btn_conf.pull_up_en = GPIO_PULLUP_ENABLE;
     gpio_config(&btn_conf);
@@ -167,6 +330,12 @@ extern "C" void app_main(void)
     setup_gptimer();
 
     while (1) {
+        if (gpio_get_level(BUTTON_B_GPIO) == 0) {
+            set_carrier_channel((carrierChannel + 1) % CARRIER_CHANNELS);
+            printf("Carrier: channel %d, %lu Hz\n", carrierChannel, (unsigned long)CARRIER_HZ[carrierChannel]);
+            display.printf("Carrier %lu kHz\n", (unsigned long)(CARRIER_HZ[carrierChannel] / 1000));
+            while (gpio_get_level(BUTTON_B_GPIO) == 0) vTaskDelay(pdMS_TO_TICKS(10));
+        }
         if (gpio_get_level(BUTTON_A_GPIO) == 0) {
             // Show MAC being sent
             display.fillScreen(TFT_BLACK);
@@ -176,12 +345,28 @@ extern "C" void app_main(void)
                            mac[0], mac[1], mac[2],
                            mac[3], mac[4], mac[5]);
 
-            // Start transmission
-            start_transmission();
-
-            // Debounce: wait for release
-            while (gpio_get_level(BUTTON_A_GPIO) == 0) {
+            // Keep the queue topped up while the button is held, so
+            // beacons go out back to back with no idle bit time between.
+            uint32_t startCount = framesSent;
+            do {
+                while (send_frame(packet, sizeof(packet), on_frame_sent, NULL) >= 0) {}
                 vTaskDelay(pdMS_TO_TICKS(10));
+            } while (gpio_get_level(BUTTON_A_GPIO) == 0);
+            while (transmitting) vTaskDelay(pdMS_TO_TICKS(10));
+
+            display.printf("Frames sent: %lu\n", (unsigned long)(framesSent - startCount));
+
+            // Per-bit ISR cost; compare CARRIER_GATE_MATRIX 1 against 0
+            if (isrCalls) {
+                printf("Bit ISR: avg %lu cycles, max %lu cycles over %lu bits\n",
+                       (unsigned long)(isrCycles / isrCalls),
+                       (unsigned long)isrCyclesMax, (unsigned long)isrCalls);
+                display.printf("ISR avg %lu max %lu cyc\n",
+                               (unsigned long)(isrCycles / isrCalls),
+                               (unsigned long)isrCyclesMax);
+                isrCycles = 0;
+                isrCyclesMax = 0;
+                isrCalls = 0;
             }
         }
         vTaskDelay(pdMS_TO_TICKS(10));
@@ -12,7 +12,8 @@
 #define LED_COUNT 10
 
 #define BAUD_RATE 2400
-#define BIT_DURATION_US (1000000 / BAUD_RATE)
+#define BIT_DURATION_US (1000000 / BAUD_RATE)  // whole µs per bit
+#define BIT_DURATION_REM (1000000 % BAUD_RATE) // fractional part, in 1/BAUD_RATE µs
 
 CRGB leds[LED_COUNT];
 
@@ -31,9 +32,29 @@ volatile bool macReady = false;
 uint8_t mac_self[6];
 
 hw_timer_t* bitTimer = NULL;
+volatile uint32_t bitPhaseRem = 0;  // fractional bit clock accumulator
+
+// BIT_DURATION_US or +1 tick, so the average sampling period is exact
+static inline uint32_t IRAM_ATTR nextBitStep() {
+  uint32_t step = BIT_DURATION_US;
+  bitPhaseRem += BIT_DURATION_REM;
+  if (bitPhaseRem >= BAUD_RATE) {
+    bitPhaseRem -= BAUD_RATE;
+    step++;
+  }
+  return step;
+}
+
+// Every transition marks a bit boundary: re-phase the sampling clock so the
+// next sample lands half a bit later, whatever the drift between crystals.
+void IRAM_ATTR onRxEdge() {
+  timerWrite(bitTimer, BIT_DURATION_US / 2);
+  bitPhaseRem = 0;
+}
 
 void IRAM_ATTR onSampleTimer() {
   bool level = gpio_get_level(IR_RECEIVE_PIN);
+  timerAlarmWrite(bitTimer, nextBitStep(), true);
 
   if (!receiving) {
     if (level == 0) {
@@ -119,6 +140,7 @@ void setup() {
 
   esp_read_mac(mac_self, ESP_MAC_WIFI_STA);
   setupTimer();
+  attachInterrupt(IR_RECEIVE_PIN, onRxEdge, CHANGE);
 }
 
 void loop() {
@@ -1,39 +1,97 @@
 //This is a IR sender for the PlatformIO framework.
 //It uses LEDC and the hardware timer.
 //It sends the ZT preamble and the devices MAC address.
+//The carrier is a runtime channel; button B steps through the channels.
 #include <M5Stack.h>
 #include <FastLED.h>
 #include "driver/ledc.h"
 #include "driver/gpio.h"
 #include "esp_system.h"
+#include "esp_rom_gpio.h"
+#include "soc/gpio_reg.h"
+#include "soc/gpio_sig_map.h"
 
 #define MODULATED_IR_PIN GPIO_NUM_26
 #define LED_PIN 15
 #define LED_COUNT 10
 
 #define BAUD_RATE 2400
-#define BIT_DURATION_US (1000000 / BAUD_RATE)
+#define BIT_DURATION_US (1000000 / BAUD_RATE)  // whole µs per bit
+#define BIT_DURATION_REM (1000000 % BAUD_RATE) // fractional part, in 1/BAUD_RATE µs
 
 #define LEDC_CHANNEL LEDC_CHANNEL_0
 #define LEDC_TIMER   LEDC_TIMER_0
-#define LEDC_FREQ    38000
 #define LEDC_RES     LEDC_TIMER_8_BIT
 
+// Carrier channels (button B)
+#define CARRIER_CHANNELS 6
+const uint32_t CARRIER_HZ[CARRIER_CHANNELS] = { 30000, 33000, 36000, 38000, 40000, 56000 };
+#define CARRIER_CHANNEL_DEFAULT 3 // 38 kHz
+
+// 1: the carrier runs continuously and each bit only switches the pin's
+//    GPIO-matrix source between the LEDC output and a constant low.
+// 0: each bit goes through ledc_set_duty/ledc_update_duty/ledc_stop.
+#define CARRIER_GATE_MATRIX 1
+#define IR_OUT_SEL_REG (GPIO_FUNC0_OUT_SEL_CFG_REG + 4 * MODULATED_IR_PIN)
+
 CRGB leds[LED_COUNT];
 uint8_t mac[6];
 uint8_t packet[8];  // 2-byte preamble + 6-byte MAC
+int carrierChannel = CARRIER_CHANNEL_DEFAULT;
 
 // Transmission state
 volatile bool transmitting = false;
 volatile int bitIndex = 0;
 volatile int byteIndex = 0;
 volatile uint8_t currentByte = 0;
+volatile uint32_t bitPhaseRem = 0;  // fractional bit clock accumulator
+
+// Precomputed GPIO_FUNCn_OUT_SEL_CFG values for the IR pin
+DRAM_ATTR uint32_t carrierOnSel = 0;   // routed to the LEDC channel
+DRAM_ATTR uint32_t carrierOffSel = 0;  // routed to GPIO_OUT, held low
+
+// Per-bit ISR cost, in CPU cycles
+volatile uint32_t isrCycles = 0;
+volatile uint32_t isrCyclesMax = 0;
+volatile uint32_t isrCalls = 0;
 
 // Timer
 hw_timer_t* bitTimer = NULL;
 
+static inline void IRAM_ATTR carrierGate(bool on) {
+#if CARRIER_GATE_MATRIX
+  REG_WRITE(IR_OUT_SEL_REG, on ? carrierOnSel : carrierOffSel);
+#else
+  if (on) {
+    ledc_set_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL, 128);
+    ledc_update_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL);
+  } else {
+    ledc_stop(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL, 0);
+  }
+#endif
+}
+
+static inline void IRAM_ATTR accountIsr(uint32_t start) {
+  uint32_t cycles = ESP.getCycleCount() - start;
+  isrCycles += cycles;
+  isrCalls++;
+  if (cycles > isrCyclesMax) isrCyclesMax = cycles;
+}
+
+// BIT_DURATION_US or +1 tick, so the average period is exact
+static inline uint32_t IRAM_ATTR nextBitStep() {
+  uint32_t step = BIT_DURATION_US;
+  bitPhaseRem += BIT_DURATION_REM;
+  if (bitPhaseRem >= BAUD_RATE) {
+    bitPhaseRem -= BAUD_RATE;
+    step++;
+  }
+  return step;
+}
+
 void IRAM_ATTR onBitTimer() {
   if (!transmitting) return;
+  uint32_t start = ESP.getCycleCount();
 
   bool bit;
   if (bitIndex == 0) bit = 0; // Start bit
@@ -42,12 +100,7 @@ void IRAM_ATTR onBitTimer() {
   else bit = 1; // Stop bit
 
   // Modulate for 0; silence for 1
-  if (bit == 0) {
-    ledc_set_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL, 128);
-    ledc_update_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL);
-  } else {
-    ledc_stop(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL, 0);
-  }
+  carrierGate(bit == 0);
 
   bitIndex++;
   if (bitIndex > 9) {
@@ -57,10 +110,16 @@ void IRAM_ATTR onBitTimer() {
       currentByte = packet[byteIndex];
     } else {
       transmitting = false;
-      ledc_stop(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL, 0);
+      carrierGate(false);
       timerAlarmDisable(bitTimer);
+      accountIsr(start);
+      return;
     }
   }
+
+  // Auto-reload picks up the new alarm value for the following bit
+  timerAlarmWrite(bitTimer, nextBitStep(), true);
+  accountIsr(start);
 }
 
 void setupLEDC() {
@@ -68,7 +127,7 @@ void setupLEDC() {
     .speed_mode = LEDC_HIGH_SPEED_MODE,
     .timer_num = LEDC_TIMER,
     .duty_resolution = LEDC_RES,
-    .freq_hz = LEDC_FREQ,
+    .freq_hz = CARRIER_HZ[carrierChannel],
     .clk_cfg = LEDC_AUTO_CLK
   };
   ledc_timer_config(&timer_conf);
@@ -82,7 +141,29 @@ void setupLEDC() {
     .timer_sel = LEDC_TIMER
   };
   ledc_channel_config(&channel_conf);
+
+#if CARRIER_GATE_MATRIX
+  // Leave the carrier running and let the ROM helper work out both
+  // matrix encodings once, so the ISR only has to write one of them.
+  ledc_set_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL, 128);
+  ledc_update_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL);
+  gpio_set_level(MODULATED_IR_PIN, 0);
+
+  esp_rom_gpio_connect_out_signal(MODULATED_IR_PIN, LEDC_HS_SIG_OUT0_IDX + LEDC_CHANNEL, false, false);
+  carrierOnSel = REG_READ(IR_OUT_SEL_REG);
+  esp_rom_gpio_connect_out_signal(MODULATED_IR_PIN, SIG_GPIO_OUT_IDX, false, false);
+  carrierOffSel = REG_READ(IR_OUT_SEL_REG);
+#else
   ledc_stop(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL, 0);
+#endif
+}
+
+// Retune between frames
+void setCarrierChannel(int ch) {
+  if (ch < 0 || ch >= CARRIER_CHANNELS) return;
+  while (transmitting) delay(1);
+  ledc_set_freq(LEDC_HIGH_SPEED_MODE, LEDC_TIMER, CARRIER_HZ[ch]);
+  carrierChannel = ch;
 }
 
 void setupTimer() {
@@ -97,6 +178,9 @@ void startTransmission() {
   byteIndex = 0;
   bitIndex = 0;
   currentByte = packet[0];
+  bitPhaseRem = 0;
+  timerWrite(bitTimer, 0);
+  timerAlarmWrite(bitTimer, nextBitStep(), true);
   timerAlarmEnable(bitTimer);
 }
 
@@ -138,6 +222,11 @@ void setup() {
 
 void loop() {
   M5.update();
+  if (M5.BtnB.wasPressed()) {
+    setCarrierChannel((carrierChannel + 1) % CARRIER_CHANNELS);
+    Serial.printf("Carrier: channel %d, %lu Hz\n", carrierChannel, (unsigned long)CARRIER_HZ[carrierChannel]);
+    M5.Lcd.printf("\nCarrier %lu kHz", (unsigned long)(CARRIER_HZ[carrierChannel] / 1000));
+  }
   if (M5.BtnA.wasPressed() && !transmitting) {
     Serial.print("Sending MAC: ");
     for (int i = 0; i < 6; i++) {
@@ -149,5 +238,14 @@ void loop() {
     printMAC();
     startTransmission();
     flashRed();
+
+    // Per-bit ISR cost; compare CARRIER_GATE_MATRIX 1 against 0
+    while (transmitting) delay(1);
+    Serial.printf("Bit ISR: avg %lu cycles, max %lu cycles over %lu bits\n",
+                  (unsigned long)(isrCycles / isrCalls),
+                  (unsigned long)isrCyclesMax, (unsigned long)isrCalls);
+    isrCycles = 0;
+    isrCyclesMax = 0;
+    isrCalls = 0;
   }
 }
@@ -1,6 +1,7 @@
 //This is a test IR sender for the ESP-IDF framekwork.
 //It uses RMT to handle the signal sending.
 //It sends a basic "Z" for testing.
+//The carrier is a runtime channel; button B steps through the channels.
 #include <stdio.h>
 #include <string.h>
 #include "driver/rmt_tx.h"
@@ -10,10 +11,16 @@
 
 #define IR_TX_GPIO GPIO_NUM_26
 #define BUTTON_A_GPIO GPIO_NUM_39
+#define BUTTON_B_GPIO GPIO_NUM_38
 
 #define BAUD_RATE 2400
-#define BIT_US (1000000 / BAUD_RATE) // ~416 µs per bit
-#define CARRIER_FREQ 38000 // 38 kHz
+#define BIT_US (1000000 / BAUD_RATE)  // whole µs per bit
+#define BIT_REM (1000000 % BAUD_RATE) // fractional part, in 1/BAUD_RATE µs
+
+// Carrier channels (button B)
+#define CARRIER_CHANNELS 6
+static const uint32_t CARRIER_HZ[CARRIER_CHANNELS] = { 30000, 33000, 36000, 38000, 40000, 56000 };
+#define CARRIER_CHANNEL_DEFAULT 3 // 38 kHz
 
 #define TX_BYTE 'Z' // 0x5A
 
@@ -26,16 +33,33 @@ static rmt_encoder_handle_t copy_encoder = NULL;
 // Persistent symbol buffer
 static rmt_symbol_word_t symbols[16];
 
+static int carrier_channel = CARRIER_CHANNEL_DEFAULT;
+
+// Fraction of a tick carried from bit to bit, across byte boundaries too
+static uint32_t phase_rem = 0;
+
 // ----------------------
 // Build UART-style byte for IR
 // ----------------------
 static size_t build_uart_byte(uint8_t byte) {
     size_t idx = 0;
 
+    // BIT_US or +1 tick, so the average bit period is exact; the 1-tick
+    // gap is part of the bit, not added to it
+    auto bit_ticks = [&]() {
+        uint32_t ticks = BIT_US;
+        phase_rem += BIT_REM;
+        if (phase_rem >= BAUD_RATE) {
+            phase_rem -= BAUD_RATE;
+            ticks++;
+        }
+        return ticks;
+    };
+
     auto set_mark = [&](size_t &i) {
         // Logic 0 = mark (carrier ON for whole bit)
         symbols[i].level0 = 1; // High
-        symbols[i].duration0 = BIT_US; // Entire bit time
+        symbols[i].duration0 = bit_ticks() - 1; // Bit time minus the gap
         symbols[i].level1 = 0; // Low
         symbols[i].duration1 = 1; // Minimal gap (non-zero)
         i++;
@@ -44,7 +68,7 @@ static size_t build_uart_byte(uint8_t byte) {
     auto set_space = [&](size_t &i) {
         // Logic 1 = space (carrier OFF for whole bit)
         symbols[i].level0 = 0; // Low
-        symbols[i].duration0 = BIT_US; // Entire bit time
+        symbols[i].duration0 = bit_ticks() - 1; // Bit time minus the gap
         symbols[i].level1 = 0;
         symbols[i].duration1 = 1; // Minimal gap (non-zero)
         i++;
@@ -69,6 +93,22 @@ static size_t build_uart_byte(uint8_t byte) {
     return idx;
 }
 
+// ----------------------
+// Carrier channel
+// ----------------------
+// Modulate marks with the channel's carrier. send_byte() waits for the
+// transmission to finish, so between calls the channel is always idle.
+static void set_carrier_channel(int ch) {
+    if (ch < 0 || ch >= CARRIER_CHANNELS) return;
+    rmt_carrier_config_t carrier_cfg = {
+        .frequency_hz = CARRIER_HZ[ch],
+        .duty_cycle = 0.5,
+        .flags = { .polarity_active_low = 0 }
+    };
+    ESP_ERROR_CHECK(rmt_apply_carrier(rmt_chan, &carrier_cfg));
+    carrier_channel = ch;
+}
+
 // ----------------------
 // Setup RMT
 // ----------------------
@@ -84,13 +124,8 @@ static void setup_rmt() {
     };
     ESP_ERROR_CHECK(rmt_new_tx_channel(&tx_chan_cfg, &rmt_chan));
 
-    // Apply 38 kHz carrier for marks
-    rmt_carrier_config_t carrier_cfg = {
-        .frequency_hz = CARRIER_FREQ,
-        .duty_cycle = 0.5,
-        .flags = { .polarity_active_low = 0 }
-    };
-    ESP_ERROR_CHECK(rmt_apply_carrier(rmt_chan, &carrier_cfg));
+    // Carrier for marks
+    set_carrier_channel(carrier_channel);
 
     // Copy encoder for raw symbol sending
     rmt_copy_encoder_config_t copy_cfg = {};
@@ -146,7 +181,7 @@ extern "C" void app_main(void) {
 
     // Init button
     gpio_config_t btn_cfg = {};
-    btn_cfg.pin_bit_mask = 1ULL << BUTTON_A_GPIO;
+    btn_cfg.pin_bit_mask = (1ULL << BUTTON_A_GPIO) | (1ULL << BUTTON_B_GPIO);
     btn_cfg.mode = GPIO_MODE_INPUT;
     btn_cfg.pull_up_en = GPIO_PULLUP_ENABLE;
     gpio_config(&btn_cfg);
@@ -157,6 +192,14 @@ extern "C" void app_main(void) {
     uint8_t byte_to_send = TX_BYTE;
 
     while (1) {
+        if (gpio_get_level(BUTTON_B_GPIO) == 0) {
+            set_carrier_channel((carrier_channel + 1) % CARRIER_CHANNELS);
+            display.printf("Carrier %lu kHz\n", (unsigned long)(CARRIER_HZ[carrier_channel] / 1000));
+
+            while (gpio_get_level(BUTTON_B_GPIO) == 0) {
+                vTaskDelay(pdMS_TO_TICKS(10));
+            }
+        }
         if (gpio_get_level(BUTTON_A_GPIO) == 0) {
             print_tx_debug(byte_to_send);
             send_byte(byte_to_send);